@@ -13,6 +13,7 @@
 #include "GEMHit.h"
 #include "GEMTracker.h"
 #include "Projection.h"
+#include "Helper.h"
 
 #include "THaDetMap.h"
 #include "TClonesArray.h"
@@ -30,6 +31,7 @@
 #include <string>
 #include <stdexcept>
 #include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace Podd;
@@ -38,16 +40,6 @@ using namespace Podd;
 
 namespace TreeSearch {
 
-struct StripData_t {
-  Float_t adcraw;
-  Float_t adc;
-  Float_t time;
-  Bool_t  pass;
-  StripData_t() : adcraw(0), adc(0), time(0), pass(false) {}
-  StripData_t( Float_t _raw, Float_t _adc, Float_t _time, Bool_t _pass )
-    : adcraw(_raw), adc(_adc), time(_time), pass(_pass) {}
-};
-
 // Sanity limit on number of channels (strips)
 static const Int_t kMaxNChan = 20000;
 
@@ -56,9 +48,11 @@ GEMPlane::GEMPlane( const char* name, const char* description,
 		    THaDetectorBase* parent )
   : Plane(name,description,parent),
     fMapType(kOneToOne), fMaxClusterSize(0), fMinAmpl(0), fSplitFrac(0),
-    fMaxSamp(1), fAmplSigma(0), fADCraw(0), fADC(0), fHitTime(0), fADCcor(0),
-    fGoodHit(0), fDnoise(0), fNrawStrips(0), fNhitStrips(0), fHitOcc(0),
-    fOccupancy(0), fADCMap(0)
+    fMaxSamp(1), fAmplSigma(0), fCMType(kCMMean), fCMTrim(0), fCMChipSize(0),
+    fSampDt(0), fPulseTp(0), fFitSigma(0), fFitNiter(0), fFitWindow(0),
+    fADCraw(0), fADC(0), fHitTime(0), fADCcor(0), fGoodHit(0), fDnoise(0),
+    fNrawStrips(0), fNhitStrips(0), fNsigStrips(0), fHitOcc(0), fOccupancy(0),
+    fADCMap(0)
 {
   // Constructor
 
@@ -133,11 +127,11 @@ void GEMPlane::Clear( Option_t* opt )
     memset( fHitTime, 0, fNelem*sizeof(Float_t) );
     memset( fADCcor, 0, fNelem*sizeof(Float_t) );
     memset( fGoodHit, 0, fNelem*sizeof(Byte_t) );
-    fSigStrips.clear();
-    fStripsSeen.assign( fNelem, false );
+    fNsamp.assign( fNelem, 0 );
+    fSigBits.assign( fSigBits.size(), 0 );
   }
 
-  fNhitStrips = fNrawStrips = 0;
+  fNhitStrips = fNrawStrips = fNsigStrips = 0;
   fHitOcc = fOccupancy = fDnoise = 0.0;
 }
 
@@ -145,7 +139,8 @@ void GEMPlane::Clear( Option_t* opt )
 Int_t GEMPlane::MapChannel( Int_t idx ) const
 {
   // Map hardware channel number to logical strip number based on mapping
-  // prescription from database
+  // prescription from database. Used to set up the lookup table fStripMap;
+  // the caller checks the range of the result.
 
   assert( (idx >= 0) and (idx < fNelem) );
 
@@ -185,79 +180,459 @@ Int_t GEMPlane::MapChannel( Int_t idx ) const
     ret = fChanMap[idx];
     break;
   }
-  assert( (ret >= 0) and (ret < fNelem) );
   return ret;
 }
 
 //_____________________________________________________________________________
-static StripData_t ChargeDep( const vector<Float_t>& amp )
+void GEMPlane::AnalyzePulses()
 {
-  // Deconvolute signal given by samples in 'amp', return approximate integral.
-  // Currently analyzes exactly 3 samples.
-  // From Kalyan Allada
-  // NIM A326, 112 (1993)
-
-  //FIXME: from database, proper value for Tp
-  const Float_t delta_t = 25.0; // time interval between samples (ns)
-  const Float_t Tp      = 50.0; // RC filter time constant (ns)
-
-  assert( amp.size() >= 3 );
-
-  Float_t adcraw = delta_t*(amp[0]+amp[1]+amp[2]);
-
-  // Weight factors calculated based on the response of the silicon microstrip
-  // detector:
-  // v(t) = (delta_t/Tp)*exp(-delta_t/Tp)
-  // Need to update this for GEM detector response(?):
-  // v(t) = A*(1-exp(-(t-t0)/tau1))*exp(-(t-t0)/tau2)
-  // where A is the amplitude, t0 the begin of the rise, tau1 the time
-  // parameter for the rising edge and tau2 the for the falling edge.
-
-  Float_t x = delta_t/Tp;
-
-  Float_t w1 = TMath::Exp(x-1)/x;
-  Float_t w2 = -2*TMath::Exp(-1)/x;
-  Float_t w3 = TMath::Exp(-x-1)/x;
-
-  // Deconvoluted signal samples, assuming measurements of zero before the
-  // leading edge
-  Float_t sig[3] = { amp[0]*w1,
-		     amp[1]*w1+amp[0]*w2,
-		     amp[2]*w1+amp[1]*w2+amp[0]*w3 };
+  // Deconvolute the ADC samples of all strips and store the raw and
+  // deconvoluted signal integrals, signal time and result of the pulse
+  // shape test in fADCraw, fADC, fHitTime and fGoodHit.
+  //
+  // The deconvolution assumes a CR-RC pulse shape with time constant
+  // fPulseTp, sampled every fSampDt (NIM A326, 112 (1993)):
+  //   s(k) = w1*a(k) + w2*a(k-1) + w3*a(k-2)
+  // taking samples before the first one to be zero. The time is the
+  // centroid of the positive deconvoluted samples, which, for a CR-RC
+  // pulse, is close to the start of the pulse. The pulse shape is good if
+  // the raw samples rise up to a positive maximum that is not in the first
+  // two samples. Strips with a single sample are taken as is.
+  //
+  // The strips are processed in blocks, each sample of all the strips of a
+  // block at a time, reading the sample-major fSamples array, so that the
+  // compiler can vectorize the loops. Strips without data (fNsamp = 0) and
+  // with null data come out as zero.
+
+  enum { kBlock = 64 };
+  const Float_t w1 = fDeconvW[0], w2 = fDeconvW[1], w3 = fDeconvW[2];
+  const Float_t dt = fSampDt;
+  const Int_t   maxsamp = fMaxSamp;
+  const Bool_t  check_pulse_shape = TestBit(kCheckPulseShape);
+
+  Float_t rawsum[kBlock], sigsum[kBlock], possum[kBlock], tsum[kBlock];
+  Float_t amax[kBlock];
+  Int_t   kmax[kBlock], krise[kBlock];
+  for( Int_t i0 = 0; i0 < fNelem; i0 += kBlock ) {
+    const Int_t n = TMath::Min( fNelem-i0, static_cast<Int_t>(kBlock) );
+    const Byte_t*  ns = &fNsamp[i0];
+    const Float_t* a0 = &fSamples[i0];
+
+    // First sample. Single samples are not deconvoluted.
+    for( Int_t j = 0; j < n; ++j ) {
+      Float_t a = a0[j];
+      a = (ns[j] > 0) ? a : 0;
+      Float_t w = (ns[j] == 1) ? 1 : w1;
+      Float_t s = w*a;
+      rawsum[j] = a;
+      sigsum[j] = s;
+      possum[j] = (s > 0) ? s : 0;
+      tsum[j]   = 0;
+      amax[j]   = a;
+      kmax[j]   = krise[j] = 0;
+    }
+    // Following samples
+    for( Int_t k = 1; k < maxsamp; ++k ) {
+      const Float_t* a  = a0 + k*fNelem;
+      const Float_t* a1 = a - fNelem;
+      const Float_t* a2 = (k >= 2) ? a1 - fNelem : a1;
+      const Float_t  w3k = (k >= 2) ? w3 : 0;
+      for( Int_t j = 0; j < n; ++j ) {
+	Bool_t  valid = (k < ns[j]);
+	Float_t s  = w1*a[j] + w2*a1[j] + w3k*a2[j];
+	Float_t ak = valid ? a[j] : 0;
+	s = valid ? s : 0;
+	Float_t sp = (s > 0) ? s : 0;
+	rawsum[j] += ak;
+	sigsum[j] += s;
+	possum[j] += sp;
+	tsum[j]   += k*sp;
+	// Length of the initial rise, and position of the maximum
+	Bool_t rising = valid & (krise[j] == k-1) & (a[j] > a1[j]);
+	krise[j] = rising ? k : krise[j];
+	Bool_t higher = valid & (a[j] > amax[j]);
+	amax[j] = higher ? a[j] : amax[j];
+	kmax[j] = higher ? k : kmax[j];
+      }
+    }
+    // Store results, one array at a time, which helps the vectorizer.
+    // Single samples are stored as is, and their time is 0, since tsum = 0.
+    Float_t* adcraw_out = fADCraw+i0;
+    Float_t* adc_out    = fADC+i0;
+    Float_t* time_out   = fHitTime+i0;
+    Byte_t*  good_out   = fGoodHit+i0;
+    for( Int_t j = 0; j < n; ++j ) {
+      Float_t scale = (ns[j] == 1) ? 1 : dt;
+      adcraw_out[j] = scale*rawsum[j];
+    }
+    for( Int_t j = 0; j < n; ++j ) {
+      Float_t scale = (ns[j] == 1) ? 1 : dt;
+      Float_t adc = scale*sigsum[j];
+      adc_out[j] = (adcraw_out[j] != 0) ? adc : 0;
+    }
+    for( Int_t j = 0; j < n; ++j ) {
+      Float_t time = dt*tsum[j]/((possum[j] > 0) ? possum[j] : 1);
+      time_out[j] = (adcraw_out[j] != 0) ? time : 0;
+    }
+    for( Int_t j = 0; j < n; ++j ) {
+      Int_t   m = ns[j];
+      Int_t   minpeak = (m < 3) ? m-1 : 2;
+      Bool_t  pass = (m == 1) | ( (kmax[j] == krise[j]) & (amax[j] > 0) &
+				  (kmax[j] >= minpeak) );
+      good_out[j] = (adcraw_out[j] != 0) & (!check_pulse_shape | pass);
+    }
+  }
+}
 
-  Float_t adc    = delta_t*(sig[0]+sig[1]+sig[2]);
-  Float_t time   = 0;     // TODO
+//_____________________________________________________________________________
+static inline Int_t NextSetBit( const ULong64_t* bits, Int_t nwords, Int_t pos )
+{
+  // Index of the first bit set at or after position pos in the bitmap bits
+  // of nwords 64-bit words, or -1 if there is none
+
+  Int_t iw = pos >> 6;
+  if( iw >= nwords )
+    return -1;
+  ULong64_t w = bits[iw] & (~0ULL << (pos & 63));
+  while( w == 0 ) {
+    if( ++iw == nwords )
+      return -1;
+    w = bits[iw];
+  }
+  return 64*iw + FindFirstSetBit64(w);
+}
 
-  Bool_t pass;
-  // Calculate ratios for 3 samples and check for bad signals
-  if( amp[2] > 0 ) {
-    Float_t r1 = amp[0]/amp[2];
-    Float_t r2 = amp[1]/amp[2];
-    pass = (r1 < 1.0 and r2 < 1.0 and r1 < r2);
-  } else
-    pass = false;
+//_____________________________________________________________________________
+static inline Int_t NextClearBit( const ULong64_t* bits, Int_t nwords, Int_t pos )
+{
+  // Index of the first bit clear at or after position pos in the bitmap bits
+  // of nwords 64-bit words, or 64*nwords if there is none. Finding the end
+  // of a run of set bits in this way takes one step per word, not per bit.
+
+  Int_t iw = pos >> 6;
+  if( iw >= nwords )
+    return 64*nwords;
+  ULong64_t w = ~bits[iw] & (~0ULL << (pos & 63));
+  while( w == 0 ) {
+    if( ++iw == nwords )
+      return 64*nwords;
+    w = ~bits[iw];
+  }
+  return 64*iw + FindFirstSetBit64(w);
+}
 
-  return StripData_t(adcraw,adc,time,pass);
+//_____________________________________________________________________________
+static void BitonicSort( Float_t* a, UInt_t n )
+{
+  // Sort the n values in a into ascending order with a bitonic sorting
+  // network. n must be a power of 2. The sequence of compare-exchange
+  // operations does not depend on the data, and the inner loops have no
+  // branches, so that they can be vectorized.
+
+  assert( n > 0 and (n & (n-1)) == 0 );
+  for( UInt_t k = 2; k <= n; k <<= 1 ) {
+    for( UInt_t j = k>>1; j > 0; j >>= 1 ) {
+      for( UInt_t b = 0; b < n; b += 2*j ) {
+	Float_t* p = a+b;
+	Float_t* q = p+j;
+	if( (b & k) == 0 ) {
+	  for( UInt_t i = 0; i < j; ++i ) {
+	    Float_t x = p[i], y = q[i];
+	    Float_t lo = (x < y) ? x : y;
+	    Float_t hi = (x < y) ? y : x;
+	    p[i] = lo;
+	    q[i] = hi;
+	  }
+	} else {
+	  for( UInt_t i = 0; i < j; ++i ) {
+	    Float_t x = p[i], y = q[i];
+	    Float_t lo = (x < y) ? x : y;
+	    Float_t hi = (x < y) ? y : x;
+	    p[i] = hi;
+	    q[i] = lo;
+	  }
+	}
+      }
+    }
+  }
 }
 
 //_____________________________________________________________________________
-void GEMPlane::AddStrip( Int_t istrip )
+void GEMPlane::SubtractCommonMode()
 {
-  // Record a hit on the given strip number in internal arrays.
-  // Utility function used by Decode.
+  // Estimate the common-mode noise of each readout chip from the corrected
+  // ADC values of its strips that have data below fMinAmpl, i.e. that are
+  // likely not part of a hit, and subtract it from all strips of the chip.
+  // The estimator is either the mean of these values, or, less biased by
+  // the tails of real signals, their median or a trimmed mean.
+
+  const Double_t minampl = fMinAmpl;
+  UInt_t nchips = fChipNoise.size();
+  assert( fChipStart.size() == nchips+1 );
+  Double_t noisesum = 0.0;
+  for( UInt_t ichip = 0; ichip < nchips; ++ichip ) {
+    // Collect the values to use, without branches
+    const Int_t* strip = &fChipStrips[fChipStart[ichip]];
+    Int_t nstrips = fChipStart[ichip+1] - fChipStart[ichip];
+    Float_t* buf = &fCMBuf[0];
+    Int_t n = 0;
+    for( Int_t i = 0; i < nstrips; ++i ) {
+      Int_t istrip = strip[i];
+      Float_t adc = fADCcor[istrip];
+      buf[n] = adc;
+      n += (fADCraw[istrip] != 0) & (adc < minampl);
+    }
+    Double_t cm = 0.0;
+    if( n > 0 ) {
+      if( fCMType == kCMMean ) {
+	Double_t sum = 0.0;
+	for( Int_t i = 0; i < n; ++i )
+	  sum += buf[i];
+	cm = sum/n;
+      } else {
+	// Sort the values. For the usual chip sizes (128 for the APV25),
+	// use a sorting network, with padding at the end up to a power of 2
+	UInt_t npad = 1;
+	while( npad < static_cast<UInt_t>(n) )
+	  npad <<= 1;
+	if( npad <= 256 ) {
+	  assert( npad <= fCMBuf.size() );
+	  for( UInt_t i = n; i < npad; ++i )
+	    buf[i] = numeric_limits<Float_t>::max();
+	  BitonicSort( buf, npad );
+	} else
+	  sort( buf, buf+n );
+	if( fCMType == kCMMedian )
+	  cm = 0.5*(buf[(n-1)/2] + buf[n/2]);
+	else {
+	  Int_t ntrim = TMath::Min( static_cast<Int_t>(fCMTrim*n), (n-1)/2 );
+	  Double_t sum = 0.0;
+	  for( Int_t i = ntrim; i < n-ntrim; ++i )
+	    sum += buf[i];
+	  cm = sum/(n-2*ntrim);
+	}
+      }
+      assert( cm < fMinAmpl );
+    }
+    fChipNoise[ichip] = cm;
+    noisesum += cm;
+  }
+  if( nchips > 0 )
+    fDnoise = noisesum/nchips;
+
+  // Subtract the noise level of each strip's chip from its ADC value
+  const Int_t*    chip  = &fStripChip[0];
+  const Double_t* noise = &fChipNoise[0];
+  for( Int_t i = 0; i < fNelem; ++i )
+    fADCcor[i] -= noise[chip[i]];
+}
 
-  Float_t adc = fADCcor[istrip];
-  if( adc > 0 )
-    ++fNhitStrips;
-  if( fGoodHit[istrip] and adc >= fMinAmpl ) {
-    fSigStrips.push_back(istrip);
+//_____________________________________________________________________________
+void GEMPlane::FitClusters()
+{
+  // Refine position and amplitude of the clusters of oversized runs of
+  // strips by fitting all clusters of each such run simultaneously with a
+  // sum of strip response templates. The template is a Gaussian of fixed
+  // width fFitSigma. The fit is an expectation-maximization iteration: the
+  // amplitude of each strip is shared among the templates in proportion to
+  // their values at the strip, and the new position and amplitude of each
+  // template are the centroid and sum of the shares it received. Unlike the
+  // split at the minimum strip, this properly deconvolutes the overlapping
+  // tails of the clusters.
+  //
+  // Runs that were split into several clusters get one template per
+  // cluster. Oversized clusters that could not be split (types 1 and 2)
+  // are seeded with several templates, one per fMaxClusterSize strips, but
+  // at least two, placed at the centers of equal parts of the cluster. The
+  // fit then decides: seeds that converge to within fFitSigma of each
+  // other, or that end up with less than fMinAmpl, are merged, and the
+  // cluster is split among the remaining ones (type 4). A single cluster
+  // that is not oversized needs no fit, since the fit then reduces to the
+  // weighted average already computed.
+  //
+  // All runs of the plane are fitted in one batch. The work is laid out as
+  // flat arrays of (strip,template) pairs, and the number of iterations is
+  // fixed, so that the cost per event is bounded and the loops over pairs
+  // and templates have no branches.
+
+  fFitClust.clear();
+  fFitRun.clear();
+  fFitPos.clear();
+  fFitAmpl.clear();
+  fPairStrip.clear();
+  fPairClust.clear();
+  fPairX.clear();
+  fPairADC.clear();
+
+  // Collect the runs of strips that were split into more than one cluster
+  // or that contain an oversized cluster. Clusters of the same run share
+  // the strip at the split.
+  typedef vector<Cluster_t>::size_type vsiz_t;
+  vsiz_t ncl = fClusters.size();
+  for( vsiz_t i = 0; i < ncl; ) {
+    vsiz_t j = i+1;
+    bool oversized = ( fClusters[i].type == 1 or fClusters[i].type == 2 );
+    while( j < ncl and fClusters[j].start == fClusters[j-1].last ) {
+      oversized = oversized or fClusters[j].type == 1 or fClusters[j].type == 2;
+      ++j;
+    }
+    if( j-i > 1 or oversized ) {
+      Int_t first = fClusters[i].start, last = fClusters[j-1].last;
+      fFitRun.push_back( fFitClust.size() );
+      for( vsiz_t k = i; k < j; ++k ) {
+	const Cluster_t& cl = fClusters[k];
+	Int_t size = cl.last - cl.start + 1, nseed = 1;
+	if( cl.type == 1 or cl.type == 2 ) {
+	  // With maxclustsiz = 0, even single strips are "oversized"
+	  UInt_t maxsize = fMaxClusterSize, usize = size;
+	  if( maxsize > 0 )
+	    nseed = TMath::Max( 2U, usize/maxsize + (usize%maxsize != 0) );
+	  else
+	    nseed = 2;
+	  nseed = TMath::Min( nseed, size/2 );
+	  nseed = TMath::Max( nseed, 1 );
+	}
+	// Each template extends fFitWindow strips beyond its cluster
+	Int_t lo = TMath::Max( first, cl.start - fFitWindow );
+	Int_t hi = TMath::Min( last,  cl.last  + fFitWindow );
+	for( Int_t iseed = 0; iseed < nseed; ++iseed ) {
+	  Int_t ifit = fFitClust.size();
+	  fFitClust.push_back( k );
+	  if( nseed == 1 )
+	    fFitPos.push_back( cl.pos );
+	  else
+	    fFitPos.push_back( GetStart() + GetPitch() *
+			       (cl.start - 0.5 + size*(iseed+0.5)/nseed) );
+	  fFitAmpl.push_back( cl.adcsum/nseed );
+	  for( Int_t istrip = lo; istrip <= hi; ++istrip ) {
+	    fPairStrip.push_back( istrip );
+	    fPairClust.push_back( ifit );
+	    fPairX.push_back( GetStart() + istrip * GetPitch() );
+	    fPairADC.push_back( fADCcor[istrip] );
+	  }
+	}
+      }
+    }
+    i = j;
   }
-#ifdef TESTCODE
-  if( TestBit(kDoHistos) ) {
-    fHitMap->Fill(istrip);
-    fADCMap->Fill(istrip, adc);
+  Int_t nfit = fFitClust.size(), npair = fPairStrip.size();
+  if( nfit == 0 )
+    return;
+  fFitRun.push_back( nfit );
+  fFitSum.resize( nfit );
+  fFitXsum.resize( nfit );
+  fPairW.resize( npair );
+
+  const Int_t*    strip = &fPairStrip[0];
+  const Int_t*    clust = &fPairClust[0];
+  const Double_t* x     = &fPairX[0];
+  const Double_t* adc   = &fPairADC[0];
+  Double_t* w    = &fPairW[0];
+  Double_t* mu   = &fFitPos[0];
+  Double_t* ampl = &fFitAmpl[0];
+  Double_t* sum  = &fFitSum[0];
+  Double_t* xsum = &fFitXsum[0];
+  Double_t* den  = &fFitDen[0];
+  const Double_t c = -0.5/(fFitSigma*fFitSigma);
+
+  for( UInt_t iter = 0; iter < fFitNiter; ++iter ) {
+    // Template value of each cluster at each strip
+    for( Int_t p = 0; p < npair; ++p ) {
+      Double_t d = x[p] - mu[clust[p]];
+      w[p] = ampl[clust[p]] * TMath::Exp( c*d*d );
+    }
+    for( Int_t p = 0; p < npair; ++p )
+      den[strip[p]] = 0;
+    for( Int_t p = 0; p < npair; ++p )
+      den[strip[p]] += w[p];
+    // Share of the strip amplitude that each cluster receives. If the sum
+    // of templates at a strip is zero, so are all the templates
+    for( Int_t p = 0; p < npair; ++p ) {
+      Double_t dp = den[strip[p]];
+      w[p] *= adc[p] / ((dp > 0) ? dp : 1.0);
+    }
+    // New position and amplitude of each cluster
+    for( Int_t k = 0; k < nfit; ++k )
+      sum[k] = xsum[k] = 0;
+    for( Int_t p = 0; p < npair; ++p ) {
+      sum[clust[p]]  += w[p];
+      xsum[clust[p]] += w[p]*x[p];
+    }
+    for( Int_t k = 0; k < nfit; ++k ) {
+      Double_t pos = xsum[k] / ((sum[k] > 0) ? sum[k] : 1.0);
+      mu[k] = (sum[k] > 0) ? pos : mu[k];
+    }
+    for( Int_t k = 0; k < nfit; ++k )
+      ampl[k] = (sum[k] > 0) ? sum[k] : ampl[k];
   }
-#endif
+
+  // Save the results, run by run. Seeds of the same cluster that converged
+  // to the same position or that are negligible are merged first. In the
+  // rare case that the fitted clusters of a run are no longer ordered by
+  // position, keep the split result for that run, since the hits must be
+  // ordered.
+  fFitOut.clear();
+  vsiz_t next = 0;  // Next cluster to copy unchanged
+  for( vsiz_t irun = 0; irun+1 < fFitRun.size(); ++irun ) {
+    Int_t k0 = fFitRun[irun], k1 = fFitRun[irun+1];
+    vsiz_t c0 = fFitClust[k0], c1 = fFitClust[k1-1];
+    while( next < c0 )
+      fFitOut.push_back( fClusters[next++] );
+    next = c1+1;
+    Int_t m = k0;
+    for( Int_t k = k0; k < k1; ++k ) {
+      if( m > k0 and fFitClust[m-1] == fFitClust[k] and
+	  ( TMath::Abs(mu[k]-mu[m-1]) < fFitSigma or
+	    ampl[k] < fMinAmpl or ampl[m-1] < fMinAmpl )) {
+	Double_t a = ampl[m-1] + ampl[k];
+	mu[m-1] = ( mu[m-1]*ampl[m-1] + mu[k]*ampl[k] ) / a;
+	ampl[m-1] = a;
+      } else {
+	fFitClust[m] = fFitClust[k];
+	mu[m] = mu[k];
+	ampl[m] = ampl[k];
+	++m;
+      }
+    }
+    Bool_t ordered = true;
+    for( Int_t k = k0+1; k < m; ++k )
+      ordered = ordered and (mu[k]-mu[k-1])*GetPitch() > 0;
+    if( !ordered ) {
+      for( vsiz_t c = c0; c <= c1; ++c )
+	fFitOut.push_back( fClusters[c] );
+      continue;
+    }
+    for( Int_t k = k0; k < m; ) {
+      const Cluster_t& cl = fClusters[fFitClust[k]];
+      Int_t kend = k+1;
+      while( kend < m and fFitClust[kend] == fFitClust[k] )
+	++kend;
+      if( kend-k == 1 ) {
+	Cluster_t fitcl = { cl.start, cl.last, cl.type, mu[k], ampl[k] };
+	fFitOut.push_back( fitcl );
+      } else {
+	// Divide the strips of the cluster among its fitted clusters at the
+	// strips nearest to the midpoints between them. As at a split, the
+	// strip at the border is shared.
+	Int_t start = cl.start;
+	for( Int_t q = k; q < kend; ++q ) {
+	  Int_t last = cl.last;
+	  if( q+1 < kend ) {
+	    Double_t mid = 0.5*(mu[q]+mu[q+1]);
+	    last = TMath::Nint( (mid-GetStart())/GetPitch() );
+	    last = TMath::Max( start, TMath::Min(cl.last, last) );
+	  }
+	  Cluster_t fitcl = { start, last, 4, mu[q], ampl[q] };
+	  fFitOut.push_back( fitcl );
+	  start = last;
+	}
+      }
+      k = kend;
+    }
+  }
+  while( next < ncl )
+    fFitOut.push_back( fClusters[next++] );
+  fClusters.swap( fFitOut );
 }
 
 //_____________________________________________________________________________
@@ -283,15 +658,12 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
 #endif
   assert( fPed.empty() or
 	  fPed.size() == static_cast<Vflt_t::size_type>(fNelem) );
-  assert( fSigStrips.empty() );
-  assert( fStripsSeen.size() == static_cast<Vbool_t::size_type>(fNelem) );
+  assert( fNsamp.size() == static_cast<Vbyte_t::size_type>(fNelem) );
+  assert( fSamples.size() >= static_cast<Vflt_t::size_type>(fMaxSamp*fNelem) );
+  assert( fSigBits.size() == static_cast<Vbits_t::size_type>((fNelem+63)/64) );
 
   UInt_t nHits = 0;
 
-  // Set up pedestal and noise corrections
-  Double_t noisesum = 0.0;
-  UInt_t   n_noise = 0;
-
   bool do_pedestal_subtraction = !fPed.empty();
   bool do_noise_subtraction    = TestBit(kDoNoise);
 
@@ -302,26 +674,29 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
     simdata = static_cast<const SimDecoder*>(&evData);
   }
 #endif
-  Vflt_t samples;
-  if( fMaxSamp > 1 )
-    samples.reserve(fMaxSamp);
 
-  // Decode data
+  // Gather the raw samples of all channels into the per-plane sample array.
+  // The strip data are then processed in passes over contiguous arrays below.
+  Float_t* samples = &fSamples[0];
+  assert( fMaxSamp < 256 );  // fits into fNsamp
+  assert( fStripMapStart.size() ==
+	  static_cast<Vint_t::size_type>(fDetMap->GetSize()) );
   for( Int_t imod = 0; imod < fDetMap->GetSize(); ++imod ) {
     THaDetMap::Module * d = fDetMap->GetModule(imod);
+    const Int_t* strip_map = &fStripMap[fStripMapStart[imod]];
 
     // Read the active channels
     Int_t nchan = evData.GetNumChan( d->crate, d->slot );
     for( Int_t ichan = 0; ichan < nchan; ++ichan ) {
       Int_t chan = evData.GetNextChan( d->crate, d->slot, ichan );
-      if( chan < d->lo or chan > d->hi ) continue; // not part of this detector
+      if( chan < 0 or chan > d->hi ) continue; // not part of this detector
 
       // Map channel number to strip number
-      Int_t istrip =
-	MapChannel( d->first + ((d->reverse) ? d->hi - chan : chan - d->lo) );
+      Int_t istrip = strip_map[chan];
+      if( istrip < 0 ) continue;               // not part of this detector
       // Test for duplicate istrip, if found, warn and skip
-      assert( (istrip >= 0) and (istrip < fNelem) );
-      if( fStripsSeen[istrip] ) {
+      assert( istrip < fNelem );
+      if( fNsamp[istrip] != 0 ) {
 	const char* inp_source = "DAQ";
 #ifdef MCDATA
 	if( mc_data )
@@ -332,61 +707,17 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
 		 istrip, GetName(), evData.GetEvNum(), inp_source );
 	continue;
       }
-      fStripsSeen[istrip] = true;
 
       // For the APV25 analog pipeline, multiple "hits" on a decoder channel
-      // correspond to time samples 25 ns apart
+      // correspond to time samples fSampDt (25 ns) apart
       Int_t nsamp = evData.GetNumHits( d->crate, d->slot, chan );
       assert( nsamp > 0 );
       ++fNrawStrips;
       nsamp = TMath::Min( nsamp, static_cast<Int_t>(fMaxSamp) );
-
-      // Integrate the signal over time and analyze pulse shape
-      StripData_t stripdata;
-      if( nsamp > 1 ) {
-	samples.clear();
-	for( Int_t isamp = 0; isamp < nsamp; ++isamp ) {
-	  Float_t fsamp = static_cast<Float_t>
-	    ( evData.GetData(d->crate, d->slot, chan, isamp) );
-	  samples.push_back( fsamp );
-	}
-	// Analyze the pulse shape
-	stripdata = ChargeDep(samples);
-      }
-      else {
-	stripdata.adcraw = stripdata.adc =
-	  static_cast<Float_t>( evData.GetData(d->crate, d->slot, chan, 0) );
-	stripdata.time = 0;
-	stripdata.pass = true;
-      }
-      // Skip null data
-      if( stripdata.adcraw == 0 )
-	continue;
-
-      // Save results for cluster finding later
-      fADCraw[istrip]  = stripdata.adcraw;
-      fADC[istrip]     = stripdata.adc;
-      fHitTime[istrip] = stripdata.time;
-
-      // Strip-by-strip pedestal subtraction
-      Float_t adc = stripdata.adc;
-      if( do_pedestal_subtraction )
-	adc -= fPed[istrip];
-
-      fADCcor[istrip] = adc;
-      fGoodHit[istrip] = not TestBit(kCheckPulseShape) or stripdata.pass;
-
-      if( do_noise_subtraction ) {
-	// Sum up ADCs that are likely not a hit
-	if( adc < fMinAmpl ) {
-	  noisesum += adc;
-	  n_noise++;
-	}
-      }
-      else {
-	// If no noise subtraction is done, then we can finish up with this
-	// strip number right here. Otherwise we need a second iteration below
-	AddStrip( istrip );
+      fNsamp[istrip] = nsamp;
+      for( Int_t isamp = 0; isamp < nsamp; ++isamp ) {
+	samples[isamp*fNelem+istrip] = static_cast<Float_t>
+	  ( evData.GetData(d->crate, d->slot, chan, isamp) );
       }
 
 #ifdef MCDATA
@@ -399,20 +730,65 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
     }  // chans
   }    // modules
 
-  // Calculate average common-mode noise and subtract it from corrected
-  // ADC values, if requested
-  if( do_noise_subtraction ) {
-    if ( n_noise > 0 ) {
-      fDnoise = noisesum/n_noise;
-      assert( fDnoise < fMinAmpl );
+  // Integrate the signal of each strip over time and analyze pulse shape
+  AnalyzePulses();
+
+  // The following loops over all strips have no branches in their bodies,
+  // so that the compiler can vectorize them.
+
+  // Strip-by-strip pedestal subtraction
+  if( do_pedestal_subtraction ) {
+    const Float_t* ped = &fPed[0];
+    for( Int_t i = 0; i < fNelem; ++i ) {
+      Float_t adc = fADC[i] - ped[i];
+      fADCcor[i] = (fADCraw[i] != 0) ? adc : 0;
     }
-    // Save strip numbers of corrected ADC data above threshold. Fill histograms.
-    assert( fSigStrips.empty() );
-    for( Int_t i = 0; i < fNelem; i++ ) {
-      fADCcor[i] -= fDnoise;
-      AddStrip( i );
+  } else
+    memcpy( fADCcor, fADC, fNelem*sizeof(Float_t) );
+
+  // Calculate the common-mode noise of each readout chip and subtract it
+  // from the corrected ADC values, if requested
+  if( do_noise_subtraction )
+    SubtractCommonMode();
+
+  UInt_t nhitstrips = 0;
+  for( Int_t i = 0; i < fNelem; ++i )
+    nhitstrips += (fADCcor[i] > 0);
+  fNhitStrips = nhitstrips;
+
+  // Apply the threshold and pulse shape cut, giving the bitmap of strips
+  // with signal. Strips without data have fGoodHit = 0 and are never set.
+  const Double_t minampl = fMinAmpl;
+  for( Int_t iw = 0, i0 = 0; i0 < fNelem; ++iw, i0 += 64 ) {
+    Int_t n = TMath::Min( fNelem-i0, 64 );
+    const Float_t* adc  = fADCcor+i0;
+    const Byte_t*  good = fGoodHit+i0;
+    Byte_t sig[64];
+    for( Int_t j = 0; j < n; ++j )
+      sig[j] = (good[j] != 0) & (adc[j] >= minampl);
+    ULong64_t bits = 0;
+    for( Int_t j = 0; j < n; ++j )
+      bits |= static_cast<ULong64_t>(sig[j]) << j;
+    fSigBits[iw] = bits;
+  }
+
+  // Count the strips with signal
+  UInt_t nsigstrips = 0;
+  for( Vbits_t::size_type iw = 0; iw < fSigBits.size(); ++iw )
+    nsigstrips += NumberOfSetBits64( fSigBits[iw] );
+  fNsigStrips = nsigstrips;
+
+#ifdef TESTCODE
+  // Fill histograms. Without noise subtraction, only strips with data
+  if( TestBit(kDoHistos) ) {
+    for( Int_t i = 0; i < fNelem; ++i ) {
+      if( do_noise_subtraction or fADCraw[i] != 0 ) {
+	fHitMap->Fill(i);
+	fADCMap->Fill(i, fADCcor[i]);
+      }
     }
   }
+#endif
 
   fHitOcc    = static_cast<Double_t>(fNhitStrips) / fNelem;
   fOccupancy = static_cast<Double_t>(GetNsigStrips()) / fNelem;
@@ -443,41 +819,48 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
   // frac = 0.1 means: trigger on a drop below 90% etc. Likewise for the
   // following valley: the bottom is found if the amplitude rises again
   // by (1+frac), so frac = 0.1 means: trigger on a rise above 110% etc.
+  // Optionally, the split and the oversized clusters are then refined with a
+  // template fit (see FitClusters).
 
-  // The active strip numbers must be sorted for the clustering algorithm
-  sort( ALL(fSigStrips) );
+  // Clusters are runs of adjacent set bits in the signal bitmap. They are
+  // found a word at a time, so the effort scales with the number of
+  // clusters rather than with the number of strips. Splitting does not modify
+  // fADCcor. Instead, the amplitude of a strip shared by two clusters is
+  // weighted by 1/2 in each of them.
 
   Double_t frac_down = 1.0 - fSplitFrac, frac_up = 1.0 + fSplitFrac;
-#ifndef NDEBUG
-  GEMHit* prevHit = 0;
-#endif
-  typedef Vint_t::iterator viter_t;
-  Vint_t splits;  // Strips with ampl split between 2 clusters
-  viter_t next = fSigStrips.begin();
-  while( next != fSigStrips.end() ) {
-    viter_t start = next, cur = next;
-    ++next;
-    assert( next == fSigStrips.end() or *next > *cur );
-    while( next != fSigStrips.end() and (*next - *cur) == 1  ) {
-      ++cur;
-      ++next;
-    }
-    // Now the cluster candidate is between start and cur
-    assert( *cur >= *start );
+  fClusters.clear();
+  const ULong64_t* sigbits = fSigBits.empty() ? 0 : &fSigBits[0];
+  const Int_t nwords = fSigBits.size();
+  Int_t start = NextSetBit( sigbits, nwords, 0 );
+  Int_t end = 0;      // One past the last strip of the current run
+  Int_t shared = -1;  // Strip shared with the previous cluster, if split
+  while( start >= 0 ) {
+    if( start >= end ) {
+      // New run of adjacent strips with signal
+      end = NextClearBit( sigbits, nwords, start );
+      shared = -1;
+    }
+    assert( end > start and end <= fNelem );
+    // The cluster candidate consists of strips start to last
+    Int_t last = end-1, split = -1;
     // The "type" parameter indicates the result of the cluster analysis:
     // 0: clean (i.e. smaller than fMaxClusterSize, no further analysis)
     // 1: large, maximum at right edge, not split
     // 2: large, no clear minimum on the right side found, not split
     // 3: split, well-defined peak found (may still be larger than maxsize)
+    // 4: large, split by the template fit (see FitClusters)
     Int_t  type = 0;
-    UInt_t size = *cur - *start + 1;
+    UInt_t size = last - start + 1;
     if( size > fMaxClusterSize ) {
       Double_t maxadc = 0.0, minadc = kBig;
-      viter_t it = start, maxpos = start, minpos = start;
+      Int_t it = start, maxpos = start, minpos = start;
       enum EStep { kFindMax = 1, kFindMin, kDone };
       EStep step = kFindMax;
-      while( step != kDone and it != next ) {
-        Double_t adc = fADCcor[*it];
+      while( step != kDone and it != end ) {
+        Double_t adc = fADCcor[it];
+        if( it == shared )
+          adc *= 0.5;
         switch( step ) {
           case kFindMax:
             // Looking for maximum
@@ -509,67 +892,84 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
       if( step == kDone ) {
         // Found maximum followed by minimum
         assert( minpos != start );
-        assert( minpos != cur );
-        assert( *minpos > *maxpos );
+        assert( minpos != last );
+        assert( minpos > maxpos );
         // Split the cluster at the position of the minimum, assuming that
-        // the strip with the minimum amplitude is shared between both clusters
-        cur  = minpos;
-        next = minpos;
+        // the strip with the minimum amplitude is shared between both clusters.
         // In order not to double-count amplitude, we split the signal height
         // of that strip evenly between the two clusters. This is a very
         // crude way of doing what we really should be doing: "fitting" a peak
         // shape and using the area and centroid of the curve
-	fADCcor[*minpos] /= 2.0;
-	splits.push_back(*minpos);
+        last  = minpos;
+        split = minpos;
       }
       type = step;
-      size = *cur - *start + 1;
-      assert( *cur >= *start );
+      size = last - start + 1;
+      assert( last >= start );
     }
     assert( size > 0 );
     // Compute weighted position average. Again, a crude (but fast) substitute
     // for fitting the centroid of the peak.
     Double_t xsum = 0.0, adcsum = 0.0;
-#ifdef MCDATA
-    Double_t mcpos = 0.0, mctime = kBig;
-    Int_t mctrack = 0, num_bg = 0;
-#endif
-    for( ; start != next; ++start ) {
-      Int_t istrip = *start;
+    for( Int_t istrip = start; istrip <= last; ++istrip ) {
       Double_t pos = GetStart() + istrip * GetPitch();
       Double_t adc = fADCcor[istrip];
+      if( istrip == shared or istrip == split )
+        adc *= 0.5;
       xsum   += pos * adc;
       adcsum += adc;
-#ifdef MCDATA
-      // If doing MC data, analyze the strip truth information
-      if( mc_data ) {
-	MCHitInfo& mc = fMCHitInfo[istrip];
-	// This may be smaller than the actual total number of background hits
-	// contributing to the entire cluster, but counting them would involve
-	// lists of secondary particle numbers ... overkill for now
-	num_bg = TMath::Max( num_bg, mc.fContam );
-	// All primary particle hits in the cluster are from the same track
-	assert( mctrack == 0 || mc.fMCTrack == 0 || mctrack == mc.fMCTrack );
-	if( mctrack == 0 ) {
-	  if( mc.fMCTrack > 0 ) {
-	    // If the cluster contains a signal hit, save its info and be done
-	    mctrack = mc.fMCTrack;
-	    mcpos   = mc.fMCPos;
-	    mctime  = mc.fMCTime;
-	  }
-	  else {
-	    // If background hits only, compute position average
-	    mcpos  += mc.fMCPos;
-	    mctime  = TMath::Min( mctime, mc.fMCTime );
-	  }
-	}
-      }
-#endif // MCDATA
     }
     assert( adcsum > 0.0 );
-    Double_t pos = xsum/adcsum;
+    Cluster_t cl = { start, last, type, xsum/adcsum, adcsum };
+    fClusters.push_back( cl );
+
+    // Continue with the remainder of a split run or with the next run
+    if( split >= 0 ) {
+      start  = split;
+      shared = split;
+    } else
+      start = NextSetBit( sigbits, nwords, end );
+  }
 
+  // Refine the split clusters with a fit of the strip response, if requested
+  if( fFitSigma > 0.0 and fFitNiter > 0 )
+    FitClusters();
+
+  // Make a hit from each cluster
+#ifndef NDEBUG
+  GEMHit* prevHit = 0;
+#endif
+  for( vector<Cluster_t>::size_type icl = 0; icl < fClusters.size(); ++icl ) {
+    const Cluster_t& cl = fClusters[icl];
+    UInt_t size = cl.last - cl.start + 1;
+    Int_t type = cl.type;
+    Double_t pos = cl.pos, adcsum = cl.adcsum;
 #ifdef MCDATA
+    Double_t mcpos = 0.0, mctime = kBig;
+    Int_t mctrack = 0, num_bg = 0;
+    // If doing MC data, analyze the strip truth information
+    for( Int_t istrip = cl.start; mc_data and istrip <= cl.last; ++istrip ) {
+      MCHitInfo& mc = fMCHitInfo[istrip];
+      // This may be smaller than the actual total number of background hits
+      // contributing to the entire cluster, but counting them would involve
+      // lists of secondary particle numbers ... overkill for now
+      num_bg = TMath::Max( num_bg, mc.fContam );
+      // All primary particle hits in the cluster are from the same track
+      assert( mctrack == 0 || mc.fMCTrack == 0 || mctrack == mc.fMCTrack );
+      if( mctrack == 0 ) {
+	if( mc.fMCTrack > 0 ) {
+	  // If the cluster contains a signal hit, save its info and be done
+	  mctrack = mc.fMCTrack;
+	  mcpos   = mc.fMCPos;
+	  mctime  = mc.fMCTime;
+	}
+	else {
+	  // If background hits only, compute position average
+	  mcpos  += mc.fMCPos;
+	  mctime  = TMath::Min( mctime, mc.fMCTime );
+	}
+      }
+    }
     if( mc_data && mctrack == 0 ) {
       mcpos /= static_cast<Double_t>(size);
     }
@@ -634,11 +1034,6 @@ Int_t GEMPlane::GEMDecode( const THaEvData& evData )
 #endif
   }
 
-  // Undo amplitude splitting, if any, so fADCcor contains correct ADC values
-  for( viter_t it = splits.begin(); it != splits.end(); ++it ) {
-    fADCcor[*it] *= 2.0;
-  }
-
   // Negative return value indicates potential problem
   if( nHits > fMaxHits )
     nHits = -nHits;
@@ -720,10 +1115,10 @@ Int_t GEMPlane::DefineVariables( EMode mode )
     { "strip.adcraw",   "Raw strip ADC sum",                "fADCraw" },
     { "strip.adc",      "Deconvoluted strip ADC sum",       "fADC" },
     { "strip.adc_c",    "Pedestal-sub strip ADC sum",       "fADCcor" },
-    { "strip.time",     "Leading time of strip signal (ns)","fHitTime" },
+    { "strip.time",     "Centroid time of strip signal (ns)","fHitTime" },
     { "strip.good",     "Good pulse shape on strip",        "fGoodHit" },
     { "nhits",          "Num hits (clusters of strips)",    "GetNhits()" },
-    { "noise",          "Noise level (avg below adc.min)",  "fDnoise" },
+    { "noise",          "Common-mode noise (avg over chips)","fDnoise" },
     { "ncoords",        "Num fit coords",                   "GetNcoords()" },
     { "coord.pos",      "Position used in fit (m)",         "fFitCoords.TreeSearch::FitCoord.fPos" },
     { "coord.trkpos",   "Track pos from projection fit (m)","fFitCoords.TreeSearch::FitCoord.fTrackPos" },
@@ -807,7 +1202,7 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
   if( !file ) return kFileError;
 
   // Set defaults
-  TString mapping;
+  TString mapping, cm_method;
   Int_t do_noise = 1, check_pulse_shape = 1;
   fMaxClusterSize = kMaxUInt;
   fMinAmpl   = 0.0;
@@ -817,6 +1212,13 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
   fChanMap.clear();
   fPed.clear();
   fAmplSigma = 0.36; // default, an educated guess
+  fCMType    = kCMMean;
+  fCMTrim    = 0.25;
+  fCMChipSize = 0;
+  fSampDt    = 25.0;
+  fPulseTp   = 50.0;
+  fFitSigma  = 0.0;
+  fFitNiter  = 10;
 
   Int_t gbl = GetDBSearchLevel(fPrefix);
   try {
@@ -834,6 +1236,13 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
       { "do_noise",       &do_noise,        kInt,     0, 1, gbl },
       { "adc.sigma",      &fAmplSigma,      kDouble,  0, 1, gbl },
       { "check_pulse_shape",&check_pulse_shape, kInt, 0, 1, gbl },
+      { "cm.method",      &cm_method,       kTString, 0, 1, gbl },
+      { "cm.chipsize",    &fCMChipSize,     kInt,     0, 1, gbl },
+      { "cm.trim",        &fCMTrim,         kDouble,  0, 1, gbl },
+      { "apv.dt",         &fSampDt,         kDouble,  0, 1, gbl },
+      { "apv.tp",         &fPulseTp,        kDouble,  0, 1, gbl },
+      { "fit.sigma",      &fFitSigma,       kDouble,  0, 1, gbl },
+      { "fit.niter",      &fFitNiter,       kUInt,    0, 1, gbl },
       { 0 }
     };
     status = LoadDB( file, date, request, fPrefix );
@@ -892,8 +1301,8 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
   fHitTime = new Float_t[fNelem];
   fADCcor = new Float_t[fNelem];
   fGoodHit = new Byte_t[fNelem];
-  fSigStrips.reserve(fNelem);
-  fStripsSeen.resize(fNelem);
+  fNsamp.assign(fNelem, 0);
+  fSigBits.assign((fNelem+63)/64, 0);
 
 #ifdef MCDATA
   if( fTracker->TestBit(Tracker::kMCdata) ) {
@@ -928,7 +1337,7 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
 	fMapType = kGassiplexAdapter1;
       }
     }
-    else if( TString("table").CompareTo(mapping,cmp) ) {
+    else if( TString("table").CompareTo(mapping,cmp) == 0 ) {
       if( fChanMap.empty() ) {
 	Error( Here(here), "Channel mapping table requested, but no map "
 	       "defined. Specify chanmap in database." );
@@ -977,6 +1386,25 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
   }
   if( fMaxSamp == 1 )
     ResetBit( kCheckPulseShape );
+  fSamples.assign( fMaxSamp*fNelem, 0 );
+
+  // Pulse deconvolution weights, based on the response of the silicon
+  // microstrip detector:
+  // v(t) = (delta_t/Tp)*exp(-delta_t/Tp)
+  // Need to update this for GEM detector response(?):
+  // v(t) = A*(1-exp(-(t-t0)/tau1))*exp(-(t-t0)/tau2)
+  // where A is the amplitude, t0 the begin of the rise, tau1 the time
+  // parameter for the rising edge and tau2 the for the falling edge.
+  if( fSampDt <= 0.0 or fPulseTp <= 0.0 ) {
+    Error( Here(here), "Illegal sample spacing apv.dt = %lf or pulse time "
+	   "constant apv.tp = %lf. Must be > 0. Fix database.",
+	   fSampDt, fPulseTp );
+    return kInitError;
+  }
+  Float_t x = fSampDt/fPulseTp;
+  fDeconvW[0] = TMath::Exp(x-1)/x;
+  fDeconvW[1] = -2*TMath::Exp(-1)/x;
+  fDeconvW[2] = TMath::Exp(-x-1)/x;
 
   if( fAmplSigma < 0.0 ) {
     Warning( Here(here), "Negative adc.sigma = %lf makes no sense. Adjusted "
@@ -988,9 +1416,135 @@ Int_t GEMPlane::ReadDatabase( const TDatime& date )
 	     "Double-check database.", fAmplSigma );
   }
 
+  // Common-mode noise correction
+  if( !cm_method.IsNull() ) {
+    if( TString("mean").CompareTo(cm_method,cmp) == 0 )
+      fCMType = kCMMean;
+    else if( TString("median").CompareTo(cm_method,cmp) == 0 )
+      fCMType = kCMMedian;
+    else if( cm_method.Length() >= 4 and
+	     TString("trimmed-mean").BeginsWith(cm_method,cmp) )
+      fCMType = kCMTrimmedMean;
+    else {
+      Error( Here(here), "Unknown common-mode method %s. Must be mean, "
+	     "median or trimmed-mean. Fix database.", cm_method.Data() );
+      return kInitError;
+    }
+  }
+  if( fCMChipSize < 0 or fCMChipSize > fNelem ) {
+    Error( Here(here), "Illegal number of channels per chip: %d. Must be "
+	   ">= 0 and <= %d. Fix database.", fCMChipSize, fNelem );
+    return kInitError;
+  }
+  if( fCMTrim < 0.0 or fCMTrim >= 0.5 ) {
+    Warning( Here(here), "Illegal common-mode trim fraction %lf. Must be "
+	     ">= 0 and < 0.5. Using 0.25.", fCMTrim );
+    fCMTrim = 0.25;
+  }
+
+  // Template fit of split clusters. The Gaussian template is cut off at
+  // 3 sigma
+  if( fFitSigma < 0.0 ) {
+    Error( Here(here), "Illegal strip response width fit.sigma = %lf. "
+	   "Must be >= 0 (0 = no fit). Fix database.", fFitSigma );
+    return kInitError;
+  }
+  static const UInt_t max_fitniter = 100; // arbitrary sanity limit
+  if( fFitNiter > max_fitniter ) {
+    Warning( Here(here), "Illegal number of fit iterations: %u. "
+	     "Adjusted to maximum allowed = %u.", fFitNiter, max_fitniter );
+    fFitNiter = max_fitniter;
+  }
+  Double_t fit_window = 3.0*fFitSigma/TMath::Abs(GetPitch());
+  fFitWindow = (fit_window < fNelem) ? TMath::CeilNint(fit_window) : fNelem;
+  fFitDen.assign( fNelem, 0 );
+
+  if( (status = SetupStripMap()) != kOK )
+    return status;
+  SetupChips();
+
   fIsInit = true;
   return kOK;
 }
+//_____________________________________________________________________________
+Int_t GEMPlane::SetupStripMap()
+{
+  // Build the lookup table from readout channel to strip number for each
+  // module of the detector map, so that decoding needs only one indexed
+  // load per channel. The table of module imod starts at
+  // fStripMapStart[imod] and has entries for channels 0 to hi, -1 for
+  // channels below lo, which are not part of this plane.
+
+  static const char* const here = "SetupStripMap";
+
+  fStripMap.clear();
+  fStripMapStart.clear();
+  Vbyte_t seen( fNelem, 0 );
+  for( Int_t imod = 0; imod < fDetMap->GetSize(); ++imod ) {
+    THaDetMap::Module * d = fDetMap->GetModule(imod);
+    fStripMapStart.push_back( fStripMap.size() );
+    for( Int_t chan = 0; chan <= d->hi; ++chan ) {
+      Int_t istrip = -1;
+      if( chan >= d->lo ) {
+	Int_t idx = d->first + ((d->reverse) ? d->hi - chan : chan - d->lo);
+	if( idx >= 0 and idx < fNelem )
+	  istrip = MapChannel( idx );
+	if( istrip < 0 or istrip >= fNelem ) {
+	  Error( Here(here), "Channel %d of module %d maps to illegal strip "
+		 "number %d. Must be >= 0 and < %d. Fix database.",
+		 chan, imod, istrip, fNelem );
+	  return kInitError;
+	}
+	if( seen[istrip] )
+	  Warning( Here(here), "Strip %d mapped more than once. Data of all "
+		   "but the first channel read will be ignored. Fix database.",
+		   istrip );
+	seen[istrip] = 1;
+      }
+      fStripMap.push_back( istrip );
+    }
+  }
+  return kOK;
+}
+
+//_____________________________________________________________________________
+void GEMPlane::SetupChips()
+{
+  // Group the strips by readout chip for the common-mode noise correction.
+  // Channels are assigned to chips in blocks of fCMChipSize, in detector
+  // map order, i.e. before the channel-to-strip mapping. With fCMChipSize
+  // = 0, all strips form one group.
+
+  Int_t chipsize = (fCMChipSize > 0) ? fCMChipSize : fNelem;
+  Int_t nchips = (fNelem + chipsize - 1) / chipsize;
+
+  fChipStrips.clear();
+  fChipStrips.reserve(fNelem);
+  fChipStart.assign(1, 0);
+  fStripChip.assign(fNelem, 0);
+  for( Int_t ichip = 0; ichip < nchips; ++ichip ) {
+    Int_t first = ichip*chipsize;
+    Int_t last  = TMath::Min( first+chipsize, fNelem );
+    for( Int_t idx = first; idx < last; ++idx ) {
+      Int_t istrip = MapChannel(idx);
+      if( istrip < 0 or istrip >= fNelem )
+	continue;
+      fChipStrips.push_back(istrip);
+      fStripChip[istrip] = ichip;
+    }
+    // Strip order within a chip makes memory access a bit more regular
+    sort( fChipStrips.begin()+fChipStart.back(), fChipStrips.end() );
+    fChipStart.push_back( fChipStrips.size() );
+  }
+  fChipNoise.assign(nchips, 0);
+
+  // Work space must hold a chip's strips, padded to a power of 2
+  UInt_t npad = 1;
+  while( npad < static_cast<UInt_t>(chipsize) )
+    npad <<= 1;
+  fCMBuf.resize(npad);
+}
+
 //_____________________________________________________________________________
 void GEMPlane::Print( Option_t* opt ) const
 {
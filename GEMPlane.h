@@ -21,10 +21,13 @@ namespace TreeSearch {
     // For ROOT RTTI
     GEMPlane()
       : fMapType(kOneToOne), fMaxClusterSize(kMaxUInt), fMinAmpl(0),
-        fSplitFrac(0.5), fMaxSamp(10), fAmplSigma(1),
+        fSplitFrac(0.5), fMaxSamp(10), fAmplSigma(1), fCMType(kCMMean),
+        fCMTrim(0.25), fCMChipSize(0), fSampDt(25), fPulseTp(50),
+        fFitSigma(0), fFitNiter(0), fFitWindow(0),
         fADCraw(0), fADC(0), fHitTime(0), fADCcor(0), fGoodHit(0),
-        fDnoise(0), fNrawStrips(0), fNhitStrips(0), fHitOcc(0), fOccupancy(0),
-        fADCMap(0) {}
+        fDnoise(0), fNrawStrips(0), fNhitStrips(0), fNsigStrips(0),
+        fHitOcc(0), fOccupancy(0), fADCMap(0)
+    { fDeconvW[0] = fDeconvW[1] = fDeconvW[2] = 0; }
     virtual ~GEMPlane();
 
     virtual void    Clear( Option_t* opt="" );
@@ -37,10 +40,12 @@ namespace TreeSearch {
     Double_t        GetAmplSigma( Double_t ampl ) const;
     Double_t        GetHitOcc()      const { return fHitOcc; }
     Double_t        GetOccupancy()   const { return fOccupancy; }
-    Int_t           GetNsigStrips()  const { return fSigStrips.size(); }
+    Int_t           GetNsigStrips()  const { return fNsigStrips; }
 
   protected:
-    typedef std::vector<bool>  Vbool_t;
+    typedef std::vector<Byte_t>    Vbyte_t;
+    typedef std::vector<Double_t>  Vdbl_t;
+    typedef std::vector<ULong64_t> Vbits_t;
 
     // Hardware channel mapping
     enum EChanMapType { kOneToOne, kReverse, kGassiplexAdapter1,
@@ -48,7 +53,11 @@ namespace TreeSearch {
 
     EChanMapType  fMapType;     // Type of hardware channel mapping to use
     Vint_t        fChanMap;     // [fNelem] Optional hardware channel mapping
+    Vint_t        fStripMap;    // Strip number of each channel of the detector
+                                // map modules, -1 if not ours
+    Vint_t        fStripMapStart;// Start of each module's table in fStripMap
     Int_t         MapChannel( Int_t idx ) const;
+    Int_t         SetupStripMap();
 
     // Parameters, calibration, flags
     UInt_t        fMaxClusterSize;// Maximum size of a clean cluster of strips
@@ -61,25 +70,76 @@ namespace TreeSearch {
     TBits         fBadChan;     // Bad channel map
     Double_t      fAmplSigma;   // Sigma of hit amplitude distribution
 
+    // Common-mode noise correction, done per readout chip (APV)
+    enum ECommonModeType { kCMMean, kCMMedian, kCMTrimmedMean };
+
+    ECommonModeType fCMType;    // Estimator of common-mode noise
+    Double_t      fCMTrim;      // Fraction of values to drop at either end
+                                // for kCMTrimmedMean
+    Int_t         fCMChipSize;  // Channels per chip (0 = whole plane)
+    Vint_t        fChipStrips;  // Strip numbers, grouped by chip
+    Vint_t        fChipStart;   // [nchips+1] Start of each chip in fChipStrips
+    Vint_t        fStripChip;   // [fNelem] Chip of each strip
+    Vdbl_t        fChipNoise;   // [nchips] Event-by-event noise per chip
+    Vflt_t        fCMBuf;       // Work space for common-mode estimation
+
+    // Pulse deconvolution
+    Double_t      fSampDt;      // Time between ADC samples (ns)
+    Double_t      fPulseTp;     // Time constant of CR-RC pulse shape (ns)
+    Float_t       fDeconvW[3];  // Deconvolution weights for samples k,k-1,k-2
+
+    // Clusters of strips of the current event
+    struct Cluster_t {
+      Int_t    start;   // First strip
+      Int_t    last;    // Last strip
+      Int_t    type;    // Result of cluster analysis, see GEMDecode
+      Double_t pos;     // Position (m)
+      Double_t adcsum;  // Sum of strip amplitudes
+    };
+    std::vector<Cluster_t> fClusters;
+
+    // Template fit of split and oversized clusters
+    Double_t      fFitSigma;    // Width of strip response template (m), 0 = no fit
+    UInt_t        fFitNiter;    // Number of fit iterations
+    Int_t         fFitWindow;   // Half-width of template (strips)
+    Vint_t        fFitClust;    // Index into fClusters of each template
+    Vint_t        fFitRun;      // Start of each run of strips in fFitClust
+    Vdbl_t        fFitPos;      // Fitted position of each template
+    Vdbl_t        fFitAmpl;     // Fitted amplitude of each template
+    Vdbl_t        fFitSum;      // Work space: amplitude share sum per template
+    Vdbl_t        fFitXsum;     // Work space: position moment per template
+    Vdbl_t        fFitDen;      // [fNelem] Work space: template sum per strip
+    Vint_t        fPairStrip;   // Strip of each (strip,cluster) pair
+    Vint_t        fPairClust;   // Fitted cluster of each pair
+    Vdbl_t        fPairX;       // Position of the pair's strip
+    Vdbl_t        fPairADC;     // Amplitude of the pair's strip
+    Vdbl_t        fPairW;       // Template value, then amplitude share of pair
+    std::vector<Cluster_t> fFitOut; // Work space: clusters after the fit
+
     // Event data, hits etc.
     Float_t*      fADCraw;      // [fNelem] Integral of raw ADC samples
     Float_t*      fADC;         // [fNelem] Integral of deconvoluted ADC samples
-    Float_t*      fHitTime;     // [fNelem] Leading-edge time of deconv signal (ns)
+    Float_t*      fHitTime;     // [fNelem] Centroid time of deconv signal (ns)
     Float_t*      fADCcor;      // [fNelem] fADC corrected for pedestal & noise
     Byte_t*       fGoodHit;     // [fNelem] Strip data passed pulse shape test
-    Double_t      fDnoise;      // Event-by-event noise (avg below fMinAmpl)
-    Vint_t        fSigStrips;   // Ordered strip numbers with signal (adccor > minampl)
-    Vbool_t       fStripsSeen;  // Flags for duplicate strip number detection
+    Double_t      fDnoise;      // Event-by-event noise, average over chips
+    Vflt_t        fSamples;     // [fMaxSamp*fNelem] Raw ADC samples, sample-major
+    Vbyte_t       fNsamp;       // [fNelem] Number of samples read (0 = no data)
+    Vbits_t       fSigBits;     // Bitmap of strips with signal, 64 per word
 
     UInt_t        fNrawStrips;  // Statistics: strips with any data
     UInt_t        fNhitStrips;  // Statistics: strips > 0
+    UInt_t        fNsigStrips;  // Statistics: strips with signal (adccor > minampl)
     Double_t      fHitOcc;      // Statistics: hit occupancy fNhitStrips/fNelem
     Double_t      fOccupancy;   // Statistics: occupancy GetNsigStrips/fNelem
 
     // Optional diagnostics for TESTCODE, keep for binary compatibility
     TH1*          fADCMap;      // Histogram of strip numbers weighted by ADC
 
-    void          AddStrip( Int_t istrip );
+    void          AnalyzePulses();
+    void          SubtractCommonMode();
+    void          SetupChips();
+    void          FitClusters();
 
     // Support functions for dummy planes
     virtual Hit*  AddHitImpl( Double_t x );
@@ -266,7 +266,7 @@ UInt_t GEMTracker::GetCrateMapDBcols() const
 //_____________________________________________________________________________
 UInt_t GEMTracker::MatchRoadsCorrAmpl( vector<Rvec_t>& roads,
 		       UInt_t /* ncombos */,
-		       list< pair<Double_t,Rvec_t> >& combos_found,
+		       Combos_t& combos_found,
 		       Rset_t& unique_found )
 {
   // Matching of Roads via amplitude correlation. Obviously, this requires
@@ -421,7 +421,7 @@ UInt_t GEMTracker::MatchRoadsCorrAmpl( vector<Rvec_t>& roads,
 
 //_____________________________________________________________________________
 UInt_t GEMTracker::MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
-				   list<std::pair<Double_t,Rvec_t> >& combos_found,
+				   Combos_t& combos_found,
 				   Rset_t& unique_found )
 {
   // Implementation of MatchRoads for GEM trackers.
@@ -448,6 +448,8 @@ UInt_t GEMTracker::MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
     nfound = MatchRoadsCorrAmpl( roads, ncombos, combos_found, unique_found );
   } else if( fast_3d ) {
     nfound = MatchRoadsFast3D( roads, ncombos, combos_found, unique_found );
+  } else if( !f3dSeed.empty() ) {
+    nfound = MatchRoadsFastN( roads, ncombos, combos_found, unique_found );
   } else {
     nfound = MatchRoadsGeneric( roads, ncombos, combos_found, unique_found );
   }
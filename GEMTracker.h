@@ -35,7 +35,7 @@ namespace TreeSearch {
     Double_t       fMaxCorrNsigma;       // Amplitude correlation cutoff (#sig)
 
     UInt_t MatchRoadsCorrAmpl( vector<Rvec_t>& roads, UInt_t ncombos,
-			       std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+			       Combos_t& combos_found,
 			       Rset_t& unique_found );
 
     virtual UInt_t GetCrateMapDBcols() const;
@@ -43,7 +43,7 @@ namespace TreeSearch {
     virtual Plane* MakePlane( const char* name, const char* description = "",
 			      THaDetectorBase* parent = 0 ) const;
     virtual UInt_t MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
-				   std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+				   Combos_t& combos_found,
 				   Rset_t& unique_found );
 
     virtual THaAnalysisObject::EStatus PartnerPlanes();
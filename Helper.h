@@ -148,6 +148,37 @@ namespace TreeSearch {
     return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
   }
 
+  //___________________________________________________________________________
+  inline Int_t NumberOfSetBits64( ULong64_t v )
+  {
+    // Count number of bits set in 64-bit integer
+
+    return NumberOfSetBits( static_cast<UInt_t>(v) ) +
+      NumberOfSetBits( static_cast<UInt_t>(v >> 32) );
+  }
+
+  //___________________________________________________________________________
+  inline Int_t FindFirstSetBit64( ULong64_t v )
+  {
+    // Index of the lowest bit set in 64-bit integer v (= number of trailing
+    // zeros). v must not be zero.
+
+    assert( v != 0 );
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    // De Bruijn multiplication, from
+    // http://graphics.stanford.edu/~seander/bithacks.html#ZerosOnRightMultLookup
+    static const Int_t kIndex[64] = {
+       0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+      62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+      63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+      46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+    };
+    return kIndex[ ((v & (~v+1)) * 0x03F79D71B4CB0A89ULL) >> 58 ];
+#endif
+  }
+
 ///////////////////////////////////////////////////////////////////////////////
 
 } // end namespace TreeSearch
@@ -87,12 +87,13 @@ Int_t MWDC::Decode( const THaEvData& evdata )
 
 //_____________________________________________________________________________
 UInt_t MWDC::MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
-			     list<std::pair<Double_t,Rvec_t> >& combos_found,
+			     Combos_t& combos_found,
 			     Rset_t& unique_found )
 {
   // Implementation of MatchRoads for MWDCs. Supports the generic and fast
-  // geometric matching algorithms. Fast matching is selected automatically
-  // in Init if the detector configuration is appropriate.
+  // geometric matching algorithms. Fast matching (3 symmetric or 4+
+  // projections) is selected automatically in Init if the detector
+  // configuration is appropriate.
 
   vector<Rvec_t>::size_type nproj = roads.size();
 
@@ -102,6 +103,8 @@ UInt_t MWDC::MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
   UInt_t nfound;
   if( TestBit(k3dFastMatch) ) {
     nfound = MatchRoadsFast3D( roads, ncombos, combos_found, unique_found );
+  } else if( !f3dSeed.empty() ) {
+    nfound = MatchRoadsFastN( roads, ncombos, combos_found, unique_found );
   } else {
     nfound = MatchRoadsGeneric( roads, ncombos, combos_found, unique_found );
   }
@@ -43,7 +43,7 @@ namespace TreeSearch {
 					Double_t angle,
 					THaDetectorBase* parent ) const;
     virtual UInt_t MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
-				   std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+				   Combos_t& combos_found,
 				   Rset_t& unique_found );
 
     virtual THaAnalysisObject::EStatus PartnerPlanes();
@@ -0,0 +1,200 @@
+#ifndef ROOT_TreeSearch_NormalEq4
+#define ROOT_TreeSearch_NormalEq4
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// TreeSearch::NormalEq4                                                     //
+//                                                                           //
+// Normal equations (At W A) b = (At W) y of a linear least-squares fit      //
+// with 4 parameters, solved by Cholesky decomposition. Fixed-size and       //
+// fully unrolled, with no heap allocations, for the 3D track fits, which    //
+// may be done thousands of times per event.                                 //
+//                                                                           //
+// SolveNormalEq4 solves many such systems at once, written so that the      //
+// compiler can vectorize across systems.                                    //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include <cmath>
+
+namespace TreeSearch {
+
+  class NormalEq4 {
+  public:
+    // Packed storage of the upper triangle of a symmetric 4x4 matrix:
+    //  0 1 2 3
+    //    4 5 6
+    //      7 8
+    //        9
+    enum { kNpar = 4, kNpacked = 10 };
+
+    NormalEq4() { Clear(); }
+
+    void Clear()
+    {
+      for( int i = 0; i < kNpacked; ++i ) fA[i] = 0;
+      for( int i = 0; i < kNpar; ++i )    fB[i] = 0;
+    }
+
+    // Add a measurement y with weight w and design row (a0,a1,a2,a3)
+    void Add( Double_t a0, Double_t a1, Double_t a2, Double_t a3,
+	      Double_t w, Double_t y )
+    {
+      Double_t wa0 = w*a0, wa1 = w*a1, wa2 = w*a2, wa3 = w*a3;
+      fA[0] += wa0*a0; fA[1] += wa0*a1; fA[2] += wa0*a2; fA[3] += wa0*a3;
+      fA[4] += wa1*a1; fA[5] += wa1*a2; fA[6] += wa1*a3;
+      fA[7] += wa2*a2; fA[8] += wa2*a3;
+      fA[9] += wa3*a3;
+      fB[0] += wa0*y;  fB[1] += wa1*y;  fB[2] += wa2*y;  fB[3] += wa3*y;
+    }
+
+    // Add the measurements of another set of equations
+    NormalEq4& operator+=( const NormalEq4& rhs )
+    {
+      for( int i = 0; i < kNpacked; ++i ) fA[i] += rhs.fA[i];
+      for( int i = 0; i < kNpar; ++i )    fB[i] += rhs.fB[i];
+      return *this;
+    }
+
+    const Double_t* GetMatrix() const { return fA; }  // Packed At W A
+    const Double_t* GetVector() const { return fB; }  // At W y
+
+    // Solve the equations, putting the 4 parameters into x. Returns false
+    // if the matrix is not positive-definite. Keeps the decomposition for
+    // use by Invert().
+    Bool_t Solve( Double_t* x );
+
+    // Get the covariance matrix of the parameters, the inverse of At W A,
+    // as a full 4x4 matrix in row-major order. Requires a successful Solve().
+    void   Invert( Double_t* cov ) const;
+
+  private:
+    Double_t fA[kNpacked];  // At W A, packed upper triangle
+    Double_t fB[kNpar];     // At W y
+    Double_t fL[kNpacked];  // Cholesky factor L (packed by rows), with
+                            // the inverse diagonal elements
+  };
+
+  //___________________________________________________________________________
+  inline Bool_t NormalEq4::Solve( Double_t* x )
+  {
+    // Cholesky decomposition A = L Lt, then forward and back substitution.
+    // L is stored as
+    //  0
+    //  1 2
+    //  3 4 5
+    //  6 7 8 9
+    // with 0,2,5,9 holding 1/L(i,i).
+
+    const Double_t* a = fA;
+    Double_t* l = fL;
+    Double_t d;
+    if( (d = a[0]) <= 0 ) return false;
+    Double_t l00 = std::sqrt(d);
+    l[0] = 1.0/l00;
+    l[1] = a[1]*l[0];
+    l[3] = a[2]*l[0];
+    l[6] = a[3]*l[0];
+    if( (d = a[4] - l[1]*l[1]) <= 0 ) return false;
+    l[2] = 1.0/std::sqrt(d);
+    l[4] = (a[5] - l[3]*l[1])*l[2];
+    l[7] = (a[6] - l[6]*l[1])*l[2];
+    if( (d = a[7] - l[3]*l[3] - l[4]*l[4]) <= 0 ) return false;
+    l[5] = 1.0/std::sqrt(d);
+    l[8] = (a[8] - l[6]*l[3] - l[7]*l[4])*l[5];
+    if( (d = a[9] - l[6]*l[6] - l[7]*l[7] - l[8]*l[8]) <= 0 ) return false;
+    l[9] = 1.0/std::sqrt(d);
+
+    // L y = b
+    Double_t y0 = fB[0]*l[0];
+    Double_t y1 = (fB[1] - l[1]*y0)*l[2];
+    Double_t y2 = (fB[2] - l[3]*y0 - l[4]*y1)*l[5];
+    Double_t y3 = (fB[3] - l[6]*y0 - l[7]*y1 - l[8]*y2)*l[9];
+    // Lt x = y
+    x[3] = y3*l[9];
+    x[2] = (y2 - l[8]*x[3])*l[5];
+    x[1] = (y1 - l[4]*x[2] - l[7]*x[3])*l[2];
+    x[0] = (y0 - l[1]*x[1] - l[3]*x[2] - l[6]*x[3])*l[0];
+    return true;
+  }
+
+  //___________________________________________________________________________
+  inline void NormalEq4::Invert( Double_t* cov ) const
+  {
+    // A^-1 = (L^-1)t L^-1. Compute M = L^-1 (lower triangular), then the
+    // products of its columns.
+
+    const Double_t* l = fL;
+    Double_t m00 = l[0], m11 = l[2], m22 = l[5], m33 = l[9];
+    Double_t m10 = -l[1]*m00*m11;
+    Double_t m21 = -l[4]*m11*m22;
+    Double_t m20 = -(l[3]*m00 + l[4]*m10)*m22;
+    Double_t m32 = -l[8]*m22*m33;
+    Double_t m31 = -(l[7]*m11 + l[8]*m21)*m33;
+    Double_t m30 = -(l[6]*m00 + l[7]*m10 + l[8]*m20)*m33;
+
+    cov[0]  = m00*m00 + m10*m10 + m20*m20 + m30*m30;
+    cov[1]  = m10*m11 + m20*m21 + m30*m31;
+    cov[2]  = m20*m22 + m30*m32;
+    cov[3]  = m30*m33;
+    cov[5]  = m11*m11 + m21*m21 + m31*m31;
+    cov[6]  = m21*m22 + m31*m32;
+    cov[7]  = m31*m33;
+    cov[10] = m22*m22 + m32*m32;
+    cov[11] = m32*m33;
+    cov[15] = m33*m33;
+    cov[4]  = cov[1];
+    cov[8]  = cov[2];  cov[9]  = cov[6];
+    cov[12] = cov[3];  cov[13] = cov[7];  cov[14] = cov[11];
+  }
+
+  //___________________________________________________________________________
+  inline void SolveNormalEq4( UInt_t n, const Double_t* const* a,
+			      const Double_t* const* b, Double_t* const* x,
+			      UChar_t* ok )
+  {
+    // Solve n sets of normal equations stored in structure-of-arrays layout:
+    // a[k][i] is element k of the packed matrix of system i (see NormalEq4),
+    // b[j][i] is element j of its right-hand side. The solutions are
+    // returned in x[j][i]. ok[i] is set to 0 if matrix i is not
+    // positive-definite, in which case x[.][i] is meaningless.
+    // The loop body has no branches, so that it can be vectorized.
+
+    for( UInt_t i = 0; i < n; ++i ) {
+      Double_t d, good = 1;
+      d = a[0][i];
+      good = (d > 0) ? good : 0;
+      Double_t l0 = 1.0/std::sqrt( (d > 0) ? d : 1.0 );
+      Double_t l1 = a[1][i]*l0, l3 = a[2][i]*l0, l6 = a[3][i]*l0;
+      d = a[4][i] - l1*l1;
+      good = (d > 0) ? good : 0;
+      Double_t l2 = 1.0/std::sqrt( (d > 0) ? d : 1.0 );
+      Double_t l4 = (a[5][i] - l3*l1)*l2;
+      Double_t l7 = (a[6][i] - l6*l1)*l2;
+      d = a[7][i] - l3*l3 - l4*l4;
+      good = (d > 0) ? good : 0;
+      Double_t l5 = 1.0/std::sqrt( (d > 0) ? d : 1.0 );
+      Double_t l8 = (a[8][i] - l6*l3 - l7*l4)*l5;
+      d = a[9][i] - l6*l6 - l7*l7 - l8*l8;
+      good = (d > 0) ? good : 0;
+      Double_t l9 = 1.0/std::sqrt( (d > 0) ? d : 1.0 );
+
+      Double_t y0 = b[0][i]*l0;
+      Double_t y1 = (b[1][i] - l1*y0)*l2;
+      Double_t y2 = (b[2][i] - l3*y0 - l4*y1)*l5;
+      Double_t y3 = (b[3][i] - l6*y0 - l7*y1 - l8*y2)*l9;
+      Double_t x3 = y3*l9;
+      Double_t x2 = (y2 - l8*x3)*l5;
+      Double_t x1 = (y1 - l4*x2 - l7*x3)*l2;
+      Double_t x0 = (y0 - l1*x1 - l3*x2 - l6*x3)*l0;
+      x[0][i] = x0; x[1][i] = x1; x[2][i] = x2; x[3][i] = x3;
+      ok[i] = (good != 0);
+    }
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // end namespace TreeSearch
+
+#endif
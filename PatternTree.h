@@ -29,6 +29,11 @@ namespace TreeSearch {
     Double_t width()    const { return fWidth; }
     Double_t maxslope() const { return fMaxslope; }
     const vector<Double_t>& zpos() const { return fZpos; }
+    bool operator==( const TreeParam_t& rhs ) const {
+      return ( fMaxdepth == rhs.fMaxdepth and fNormalized == rhs.fNormalized
+	       and fWidth == rhs.fWidth and fMaxslope == rhs.fMaxslope
+	       and fZpos == rhs.fZpos );
+    }
   private:
     UInt_t    fMaxdepth;    // Depth of tree
     Bool_t    fNormalized;  // maxslope and zpos are normalized
@@ -17,11 +17,13 @@
 #include "Helper.h"
 #include "Hit.h"
 #include "Tracker.h"   // for Tracker bits
+#include "TaskPool.h"
 
 #include "TMath.h"
 #include "TString.h"
 #include "TBits.h"
 #include "TError.h"
+#include "TMutex.h"
 
 #include <iostream>
 #include <sstream>
@@ -44,6 +46,100 @@ static const UInt_t kMinFitPlanes = 3;
 // Parameter for angle consistency check in SetAngle (rad)
 static const Double_t kAngleTolerance = 1.0 * TMath::DegToRad();
 
+//_____________________________________________________________________________
+// Pattern trees are shared by all projections with identical tree parameters,
+// including those of different Tracker instances in the same process. Once
+// generated, a tree is read-only, so any number of projections can search
+// it at the same time, each with its own hitpattern and results.
+// The registry itself is protected by a mutex, so projections may be
+// initialized and destroyed in different threads. A tree is generated
+// while holding the lock, so a second request for the same parameters
+// waits for it instead of generating a duplicate.
+
+struct SharedTree_t {
+  TreeParam_t  param;  // Normalized tree parameters
+  PatternTree* tree;   // The tree
+  UInt_t       nref;   // Number of projections using it
+  SharedTree_t( const TreeParam_t& p, PatternTree* t )
+    : param(p), tree(t), nref(1) {}
+};
+static vector<SharedTree_t> gSharedTrees;
+
+//_____________________________________________________________________________
+static TMutex& SharedTreesLock()
+{
+  // Mutex protecting gSharedTrees, created on first use
+
+  static TMutex lock;
+  return lock;
+}
+
+//_____________________________________________________________________________
+static PatternTree* AcquirePatternTree( const TreeParam_t& tp )
+{
+  // Get the tree for the given (normalized) parameters, generating it if
+  // no other projection is using such a tree yet. Returns 0 on error.
+
+  TMutex& lock = SharedTreesLock();
+  lock.Lock();
+  for( vector<SharedTree_t>::iterator it = gSharedTrees.begin();
+       it != gSharedTrees.end(); ++it ) {
+    if( it->param == tp ) {
+      ++it->nref;
+      lock.UnLock();
+      return it->tree;
+    }
+  }
+  // Attempt to read the pattern database from file
+  //TODO: Make the file name
+  // const char* filename = "test.tree";
+  // PatternTree* tree = PatternTree::Read( filename, tp );
+
+  // If the tree cannot not be read (or the parameters mismatch), then
+  // create it from scratch (takes a few seconds)
+  // if( !tree ) {
+  PatternGenerator pg;
+  PatternTree* tree = pg.Generate( tp );
+  if( tree ) {
+    // Write the freshly-generated tree to file
+    // FIXME: hmmm... we don't necesarily have write permission to DB_DIR
+    //       tree->Write( filename );
+    gSharedTrees.push_back( SharedTree_t(tp,tree) );
+  }
+  // }
+  lock.UnLock();
+  return tree;
+}
+
+//_____________________________________________________________________________
+static void ReleasePatternTree( PatternTree* tree )
+{
+  // Release a tree obtained from AcquirePatternTree. The tree is deleted
+  // when the last projection using it has released it. Trees not obtained
+  // from AcquirePatternTree (see Projection::SetPatternTree) are deleted
+  // right away.
+
+  if( !tree )
+    return;
+  TMutex& lock = SharedTreesLock();
+  lock.Lock();
+  for( vector<SharedTree_t>::iterator it = gSharedTrees.begin();
+       it != gSharedTrees.end(); ++it ) {
+    if( it->tree == tree ) {
+      assert( it->nref > 0 );
+      if( --it->nref == 0 ) {
+	gSharedTrees.erase( it );
+	lock.UnLock();
+	delete tree;
+      } else
+	lock.UnLock();
+      return;
+    }
+  }
+  lock.UnLock();
+  delete tree;
+}
+
 //_____________________________________________________________________________
 Projection::Projection( EProjType type, const char* name, Double_t angle,
 			THaDetectorBase* parent )
@@ -53,7 +149,8 @@ Projection::Projection( EProjType type, const char* name, Double_t angle,
     fMinFitPlanes(kMinFitPlanes), fMaxMiss(0), fRequire1of2(false),
     fPlaneCombos(0), fAltPlaneCombos(0), fMaxPat(kMaxUInt),
     fFrontMaxBinDist(kMaxUInt), fBackMaxBinDist(kMaxUInt), fHitMaxDist(0),
-    fConfLevel(1e-3), fHitpattern(0), fRoads(0), fNgoodRoads(0),
+    fConfLevel(1e-3), fMinParallelRoads(kMaxUInt), fFitPool(0),
+    fHitpattern(0), fRoads(0), fNgoodRoads(0),
     fRoadCorners(0), fTrkStat(kTrackOK)
 {
   // Constructor
@@ -84,7 +181,7 @@ Projection::~Projection()
     RemoveVariables();
   delete fRoads;
   delete fRoadCorners;
-  delete fPatternTree;
+  ReleasePatternTree( fPatternTree );
   delete fHitpattern;
   if( fAltPlaneCombos != fPlaneCombos )
     delete fAltPlaneCombos;
@@ -213,7 +310,7 @@ void Projection::Reset( Option_t* opt )
   fIsInit = kFALSE;
   fMaxSlope = fWidth = 0.0;
   delete fHitpattern; fHitpattern = 0;
-  delete fPatternTree; fPatternTree = 0;
+  ReleasePatternTree( fPatternTree ); fPatternTree = 0;
   if( fAltPlaneCombos != fPlaneCombos ) {
     delete fAltPlaneCombos; fAltPlaneCombos = 0;
   }
@@ -412,24 +509,12 @@ THaAnalysisObject::EStatus Projection::Init( const TDatime& date )
     if( tp.Normalize() != 0 )
       return fStatus = kInitError;
 
-    // Attempt to read the pattern database from file
+    // Get the pattern database, shared with any other projections that
+    // have the same tree parameters
     assert( fPatternTree == 0 );
-    //TODO: Make the file name
-    // const char* filename = "test.tree";
-    // fPatternTree = PatternTree::Read( filename, tp );
-
-    // If the tree cannot not be read (or the parameters mismatch), then
-    // create it from scratch (takes a few seconds)
-    // if( !fPatternTree ) {
-      PatternGenerator pg;
-      fPatternTree = pg.Generate( tp );
-      if( fPatternTree ) {
-	// Write the freshly-generated tree to file
-	// FIXME: hmmm... we don't necesarily have write permission to DB_DIR
-	//       fPatternTree->Write( filename );
-      } else
-	return fStatus = kInitError;
-    // }
+    fPatternTree = AcquirePatternTree( tp );
+    if( !fPatternTree )
+      return fStatus = kInitError;
 
     // Set up a hitpattern object with the parameters of this projection
     assert( fHitpattern == 0 );
@@ -547,7 +632,7 @@ Int_t Projection::ReadDatabase( const TDatime& date )
   fMaxMiss = 0;
   fMaxPat  = kMaxUInt;
   fConfLevel = 1e-3;
-  Int_t req1of2 = 0, disable_chi2 = 0;
+  Int_t req1of2 = 0, disable_chi2 = 0, mt_minroads = 16;
 
   Int_t gbl = Plane::GetDBSearchLevel(fPrefix);
   const DBRequest request[] = {
@@ -560,6 +645,7 @@ Int_t Projection::ReadDatabase( const TDatime& date )
     { "req1of2",         &req1of2,       kInt,    0, 1, gbl },
     { "maxpat",          &fMaxPat,       kUInt,   0, 1, gbl },
     { "disable_chi2",    &disable_chi2,  kInt,    0, 1, gbl },
+    { "mt_minroads",     &mt_minroads,   kInt,    0, 1, gbl },
     { 0 }
   };
 
@@ -596,6 +682,11 @@ Int_t Projection::ReadDatabase( const TDatime& date )
 
   fRequire1of2 = (req1of2 != 0);
 
+  // Fit roads in parallel if there are at least this many. A value <= 0
+  // disables parallel fitting. Only effective if the tracker runs with
+  // more than one thread.
+  fMinParallelRoads = (mt_minroads > 0) ? mt_minroads : kMaxUInt;
+
   // If any planes defined, update their coordinate offset
   // based on our possibly new angle
   for( vplsiz_t i = 0; i < fPlanes.size(); ++i ) {
@@ -728,7 +819,73 @@ Int_t Projection::Track()
   // - fit hits in each road
   // - filter roads according to chi^2 and similarity
   //
-  // Results in fRoads
+  // Results in fRoads. Returns the number of good roads, or -1 on error.
+
+#ifdef TESTCODE
+  TStopwatch timer_tot;
+#endif
+
+  Int_t ret = FindRoads();
+  Double_t tfit = 0, ttrack = 0;
+  if( ret > 0 ) {
+#ifdef TESTCODE
+    TStopwatch timer;
+#endif
+    // Fit hit positions in the roads to straight lines
+    FitRoads();
+
+#ifdef TESTCODE
+    tfit   = 1e6*timer.RealTime();
+    ttrack = 1e6*timer_tot.RealTime();
+#endif
+  }
+  return EndTrack( ret, tfit, ttrack );
+}
+
+//_____________________________________________________________________________
+Int_t Projection::EndTrack( Int_t ret, Double_t tfit, Double_t ttrack )
+{
+  // Last stage of Track(), after FindRoads() returned 'ret' and, if ret > 0,
+  // the road fits have been collected. Records the fit time and total
+  // tracking time in us (TESTCODE) and prints the summary (VERBOSE).
+  // Returns the Track() result.
+
+  if( ret > 0 ) {
+#ifdef TESTCODE
+    t_fit   = tfit;
+    t_track = ttrack;
+#endif
+
+#ifdef VERBOSE
+    if( fDebug > 0 ) {
+      if( !fRoads->IsEmpty() ) {
+	Int_t nroads = GetNgoodRoads();
+	cout << nroads << " road";
+	if( nroads!=1 ) cout << "s";
+	cout << " successfully fit" << endl;
+      }
+    }
+#endif
+
+    ret = GetNgoodRoads();
+  }
+
+#ifdef VERBOSE
+  if( fDebug > 0 ) {
+    cout << "------------ end of projection  " << GetName()
+	 << "------------" << endl;
+  }
+#endif
+  return ret;
+}
+
+//_____________________________________________________________________________
+Int_t Projection::FindRoads()
+{
+  // First stage of Track(): match the hitpattern against the pattern tree
+  // and combine the patterns found into roads.
+  // Returns the number of roads (fits not done yet), 0 if no patterns were
+  // found, or -1 if there were too many patterns.
 
   Int_t ret = 0;
 
@@ -740,7 +897,7 @@ Int_t Projection::Track()
   assert( GetTrackingStatus() == kTrackOK );
 
 #ifdef TESTCODE
-  TStopwatch timer, timer_tot;
+  TStopwatch timer;
 #endif
 
   ComparePattern compare( fHitpattern, fAltPlaneCombos, &fPatternsFound,
@@ -817,37 +974,11 @@ Int_t Projection::Track()
 // #endif
 #ifdef TESTCODE
   t_roads = 1e6*timer.RealTime();
-  timer.Start();
 #endif
 
-  // Fit hit positions in the roads to straight lines
-  FitRoads();
-
-#ifdef TESTCODE
-  t_fit   = 1e6*timer.RealTime();
-  t_track = 1e6*timer_tot.RealTime();
-#endif
-
-#ifdef VERBOSE
-  if( fDebug > 0 ) {
-    if( !fRoads->IsEmpty() ) {
-      Int_t nroads = GetNgoodRoads();
-      cout << nroads << " road";
-      if( nroads!=1 ) cout << "s";
-      cout << " successfully fit" << endl;
-    }
-  }
-#endif
-
-  ret = GetNgoodRoads();
+  ret = GetNroads();
 
  quit:
-#ifdef VERBOSE
-  if( fDebug > 0 ) {
-    cout << "------------ end of projection  " << GetName()
-	 << "------------" << endl;
-  }
-#endif
   return ret;
 }
 
@@ -1080,17 +1211,53 @@ Bool_t Projection::RemoveDuplicateRoads()
   return changed;
 }
 
+//_____________________________________________________________________________
+class RoadFitTask : public TaskPool::Task {
+  // Fit the roads of a projection, possibly in parallel. Results are
+  // recorded per road so they can be reduced in road order afterwards.
+public:
+  RoadFitTask( const Projection* proj, vector<Int_t>& good )
+    : fProj(proj), fGood(good) {}
+  virtual void Run( UInt_t i ) { fGood[i] = fProj->GetRoad(i)->Fit(); }
+private:
+  const Projection* fProj;
+  vector<Int_t>&    fGood;
+};
+
 //_____________________________________________________________________________
 Bool_t Projection::FitRoads()
 {
   // Fit hits within each road. Store fit parameters with Road.
   // Also, store the hits & positions used by the best fit with Road.
-  bool changed = false;
+  // If a worker pool is available and there are at least fMinParallelRoads
+  // roads, the roads are fit in parallel.
+
+  UInt_t nroads = GetNroads();
+  vector<Int_t> good( nroads, 0 );
+  RoadFitTask fit( this, good );
+  if( fFitPool and nroads >= fMinParallelRoads )
+    fFitPool->Process( &fit, nroads );
+  else {
+    for( UInt_t i = 0; i < nroads; ++i )
+      fit.Run(i);
+  }
 
-  for( UInt_t i = 0; i < GetNroads(); ++i ) {
-    Road* rd = static_cast<Road*>(fRoads->UncheckedAt(i));
-    assert(rd);
-    if( rd->Fit() )
+  return CollectRoadFits( good );
+}
+
+//_____________________________________________________________________________
+Bool_t Projection::CollectRoadFits( const vector<Int_t>& good )
+{
+  // Last stage of Track(): record the results of the road fits, good[i]
+  // being the return value of Fit() for road i. Results are collected in
+  // road order, independent of thread scheduling.
+  // Returns true if any fits failed.
+
+  bool changed = false;
+  UInt_t nroads = GetNroads();
+  assert( good.size() == nroads );
+  for( UInt_t i = 0; i < nroads; ++i ) {
+    if( good[i] )
       // Count good roads (not void and good fit)
       ++fNgoodRoads;
     else {
@@ -1100,7 +1267,7 @@ Bool_t Projection::FitRoads()
 #endif
     }
   }
-  if( GetNroads() > 0 && fNgoodRoads == 0 )
+  if( nroads > 0 && fNgoodRoads == 0 )
     fTrkStat = kFailed2DFits;
 
   return changed;
@@ -31,6 +31,7 @@ namespace TreeSearch {
   class PatternTree;
   class Road;
   class Plane;
+  class TaskPool;
 
   typedef std::vector<Plane*>            vpl_t;
   typedef std::vector<Plane*>::size_type vplsiz_t;
@@ -47,7 +48,8 @@ namespace TreeSearch {
         fFirstPlaneNum(0), fLastPlaneNum(0), fMinFitPlanes(0), fMaxMiss(0),
         fRequire1of2(false), fPlaneCombos(0), fAltPlaneCombos(0),
         fMaxPat(kMaxUInt), fFrontMaxBinDist(0), fBackMaxBinDist(0),
-        fHitMaxDist(0), fConfLevel(0.001), fHitpattern(0),
+        fHitMaxDist(0), fConfLevel(0.001), fMinParallelRoads(kMaxUInt),
+        fFitPool(0), fHitpattern(0),
         fRoads(0), fNgoodRoads(0), fRoadCorners(0), fTrkStat(kTrackOK),
         n_hits(0), n_bins(0), n_binhits(0), maxhits_bin(0),
         n_test(0), n_pat(0), n_roads(0), n_dupl(0), n_badfits(0),
@@ -66,6 +68,11 @@ namespace TreeSearch {
     Int_t           FillHitpattern();
     Int_t           Track();
     Int_t           MakeRoads();
+    // Stages of Track(), for scheduling them separately
+    Int_t           FindRoads();
+    Bool_t          CollectRoadFits( const std::vector<Int_t>& good );
+    Int_t           EndTrack( Int_t ret, Double_t tfit, Double_t ttrack );
+    UInt_t          GetMinParallelRoads() const { return fMinParallelRoads; }
 
     static EProjType NameToType( const char* name );
 
@@ -100,6 +107,7 @@ namespace TreeSearch {
     UInt_t          GetLastPlaneNum()      const { return fLastPlaneNum; }
 
     void            SetPatternTree( PatternTree* pt ) { fPatternTree = pt; }
+    void            SetFitPool( TaskPool* pool ) { fFitPool = pool; }
 
     const vpl_t&    GetListOfPlanes() const { return fPlanes; }
 
@@ -163,7 +171,7 @@ namespace TreeSearch {
     Double_t         fWidth;         // Width of tracking region (m)
     TVector2         fAxis;          // Projection axis, normal to strips
     THaDetectorBase* fDetector;      //! Parent detector
-    PatternTree*     fPatternTree;   // Precomputed template database
+    PatternTree*     fPatternTree;   // Precomputed template database (shared)
 
     UInt_t           fDummyPlanePattern; // Bitpattern of dummy plane numbers
     UInt_t           fFirstPlaneNum; // Idx of first active plane in fAllPlanes
@@ -187,6 +195,10 @@ namespace TreeSearch {
     Double_t         fConfLevel;     // Requested confidence level for chi2 cut
     vec_pdbl_t       fChisqLimits;   // lo/hi onfidence interval limits on Chi2
 
+    // Multithread support
+    UInt_t           fMinParallelRoads; // Min # roads for parallel fitting
+    TaskPool*        fFitPool;       //! Worker pool for road fits (from Tracker)
+
     // Event-by-event results
     Hitpattern*      fHitpattern;    // Hitpattern of current event
     NodeVec_t        fPatternsFound; // Patterns found by TreeSearch
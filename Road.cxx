@@ -23,10 +23,8 @@
 
 #include <iostream>
 #include <algorithm>
-#include <numeric>
 #include <map>
 #include <utility>
-#include <stdexcept>
 
 using namespace std;
 using namespace Podd;
@@ -164,8 +162,8 @@ Road::Road( const Projection* proj )
     fNMCTrackHits(0), fMCTrackPlanePattern(0),
     fNMCTrackHitsFit(0), fMCTrackPlanePatternFit(0),
 #endif
-    fPos(kBig), fSlope(kBig), fChi2(kBig), fDof(kMaxUInt), fGood(false),
-    fTrack(0), fBuild(0), fGrown(false), fTrkStat(kTrackOK)
+    fPos(kBig), fSlope(kBig), fChi2(kBig), fDof(kMaxUInt), fFitYWY(0),
+    fGood(false), fTrack(0), fBuild(0), fGrown(false), fTrkStat(kTrackOK)
 #ifdef TESTCODE
   , fNfits(0)
 #endif
@@ -189,8 +187,8 @@ Road::Road( const Node_t& nd, const Projection* proj )
     fNMCTrackHitsFit(0), fMCTrackPlanePatternFit(0),
 #endif
     fPos(kBig), fSlope(kBig), fChi2(kBig),
-    fDof(kMaxUInt), fGood(false), fTrack(0), fBuild(0), fGrown(true),
-    fTrkStat(kTrackOK)
+    fDof(kMaxUInt), fFitYWY(0), fGood(false), fTrack(0), fBuild(0),
+    fGrown(true), fTrkStat(kTrackOK)
 #ifdef TESTCODE
   , fNfits(0)
 #endif
@@ -499,7 +497,7 @@ void Road::Finish()
   fHits.swap( fBuild->fCluster.hits );
 
   // Calculate the vertices fCornerX of a trapezoid with points in the
-  // order LL (lower left), LR, UR, UL, LL, as needed by TMath::IsInside()
+  // order LL (lower left), LR, UR, UL, LL, as used by CollectCoordinates()
 
   // Convert the bin numbers of the left/right edges to physical coordinates
   vector< pair<Double_t,Double_t> > edgpos;
@@ -618,33 +616,53 @@ Bool_t Road::CollectCoordinates()
     fPatterns.front()->first.Print();
   }
 #endif
-  Double_t zp[kNcorner] = { fZL, fZL, fZU, fZU, fZL };
   Bool_t good = true;
 #ifdef MCDATA
   Bool_t mcdata = fProjection->TestBit(Projection::kMCdata);
   TBits mcpattern;
 #endif
 
-  // Collect the hit coordinates within this Road
+  // Collect the hit coordinates within this Road.
+  // The road is a trapezoid with straight left and right edges, so in each
+  // plane the allowed x positions form the interval [xl,xr]. We compute
+  // that interval analytically and get the candidate hits directly from the
+  // plane's sorted hit array with a binary search. The search range is
+  // widened by the maximum distance between a hit's reference position and
+  // its actual coordinates (L/R ambiguity of wire chamber hits).
+  // Only hits found by the tree search (fHits) are used. Hits that the
+  // pattern binning missed may also lie in this interval. Adding them would
+  // change the fitted combinations and the shared-hit conflicts between
+  // roads, so they are skipped.
   TBits planepattern;
-  UInt_t last_np = kMaxUInt;
-  for( siter_t it = fHits.begin(); it != fHits.end(); ++it ) {
-    Hit* hit = const_cast<Hit*>(*it);
-    // Skip all hits from planes in calibration mode - these are not fitted
-    if( hit->GetPlane()->IsCalibrating() )
+  const Double_t idz = 1.0/(fZU-fZL);
+  const Double_t slopeL = (fCornerX[3]-fCornerX[0])*idz;
+  const Double_t slopeR = (fCornerX[2]-fCornerX[1])*idz;
+  for( UInt_t np = 0; np < fProjection->GetNplanes(); ++np ) {
+    Plane* pl = fProjection->GetPlane(np);
+    assert( pl->GetPlaneNum() == np );
+    // Skip all planes in calibration mode - their hits are not fitted
+    if( pl->IsCalibrating() )
       continue;
-    Double_t z = hit->GetZ();
-    UInt_t np = hit->GetPlaneNum();
-    UInt_t i = hit->GetNumPos(); // Wire chamber hits may have 2 pos'ns (L/R)
-    assert( np != kMaxUInt );
-    assert( i>0 );
-    do {
-      Double_t x = hit->GetPosI(--i);
-      if( TMath::IsInside( x, z, kNcorner, &fCornerX[0], zp )) {
-	if( np != last_np ) {
-	  // The hits are sorted by ascending plane number, so fPoints gets
+    Double_t z  = pl->GetZ();
+    Double_t xl = fCornerX[0] + slopeL*(z-fZL);
+    Double_t xr = fCornerX[1] + slopeR*(z-fZL);
+    Double_t dx = pl->GetMaxLRdist() + 1e-6;
+    pair<Int_t,Int_t> range = pl->FindHitsInRange( xl-dx, xr+dx );
+    bool first = true;
+    for( Int_t ih = range.first; ih < range.second; ++ih ) {
+      Hit* hit = pl->GetHit(ih);
+      siter_t found = fHits.find( hit );
+      if( found == fHits.end() or *found != hit )
+	continue;
+      UInt_t i = hit->GetNumPos(); // Wire chamber hits may have 2 pos'ns (L/R)
+      assert( i>0 );
+      do {
+	Double_t x = hit->GetPosI(--i);
+	if( x < xl or x > xr )
+	  continue;
+	if( first ) {
+	  // Planes are visited in ascending order, so fPoints gets
 	  // one element vector per plane
-	  assert( last_np == kMaxUInt or np > last_np );
 	  fPoints.push_back( Pvec_t() );
 	  planepattern.SetBitNumber(np);
 #ifdef MCDATA
@@ -657,11 +675,11 @@ Bool_t Road::CollectCoordinates()
 	      mcpattern.SetBitNumber(np);
 	  }
 #endif
-	  last_np = np;
+	  first = false;
 	}
 	fPoints.back().push_back( new Point(x, z, hit) );
-      }
-    } while( i );
+      } while( i );
+    }
   }
   // Check if this matchpattern is acceptable
   UInt_t patternvalue = 0;
@@ -714,6 +732,31 @@ Bool_t Road::CollectCoordinates()
   return good;
 }
 
+//_____________________________________________________________________________
+struct FitSums {
+  // Weighted sums for the straight-line fit x = a1 + a2*z of a set of points
+  Double_t S11, S12, S22, G1, G2, Sxx;
+  FitSums() : S11(0), S12(0), S22(0), G1(0), G2(0), Sxx(0) {}
+  void Add( Double_t x, Double_t z, Double_t r ) {
+    S11 += r;
+    S12 += z * r;
+    S22 += z * z * r;
+    G1  += x * r;
+    G2  += x * z * r;
+    Sxx += x * x * r;
+  }
+  Double_t Chi2() const {
+    // Chi2 of the best fit to the points, calculated from the sums alone
+    Double_t D = S11*S22 - S12*S12;
+    if( D <= 0 )
+      return 0;
+    Double_t a1 = (G1*S22 - G2*S12)/D;
+    Double_t a2 = (G2*S11 - G1*S12)/D;
+    Double_t chi2 = Sxx - a1*G1 - a2*G2;
+    return (chi2 > 0) ? chi2 : 0;
+  }
+};
+
 //_____________________________________________________________________________
 Bool_t Road::Fit()
 {
@@ -748,15 +791,20 @@ Bool_t Road::Fit()
     return false;
   }
 
-  // Determine number of permutations
-  UInt_t n_combinations;
-  try {
-    n_combinations = accumulate( ALL(fPoints),
-				 (UInt_t)1, SizeMul<Pvec_t>() );
-  }
-  catch( overflow_error& ) {
-    fTrkStat = kTooManyHitCombos;
-    return false;
+  // Determine number of permutations. The product saturates instead of
+  // overflowing, so that roads with very many points are always rejected.
+  const ULong64_t kMaxCombos = ~static_cast<ULong64_t>(0);
+  ULong64_t n_combinations = 1;
+  for( vector<Pvec_t>::const_iterator it = fPoints.begin();
+       it != fPoints.end(); ++it ) {
+    ULong64_t n = it->size();
+    if( n == 0 )
+      continue;
+    if( n_combinations > kMaxCombos / n ) {
+      n_combinations = kMaxCombos;
+      break;
+    }
+    n_combinations *= n;
   }
   if( n_combinations > kMaxNhitCombos ) {
     fTrkStat = kTooManyHitCombos;
@@ -767,36 +815,72 @@ Bool_t Road::Fit()
   Bool_t mcdata = fProjection->TestBit(Projection::kMCdata);
 #endif
 
-  // Loop over all combinations of hits in the planes
+  // Enumerate the hit combinations depth-first, one plane per level.
+  // sums[k] holds the weighted sums of the points selected in planes 0..k-1,
+  // so consecutive combinations that differ only in the deeper planes reuse
+  // the partial sums of the planes above them, and each combination costs
+  // O(1) amortized instead of O(npts).
+  // Since adding points to a straight-line fit can never decrease its chi2,
+  // the chi2 of a partial combination is a lower bound for all combinations
+  // built from it. Subtrees whose partial chi2 already exceeds the best chi2
+  // found so far (or, once a fit has been saved, the upper limit of the
+  // chi2 confidence interval) cannot yield a better accepted fit and are
+  // skipped entirely.
+  // The sums are accumulated relative to the lower left road corner to
+  // avoid cancellation in the analytic chi2 = Sxx - a1*G1 - a2*G2. The
+  // parameters of the best fit are recomputed exactly from its points.
   vector<Pvec_t>::size_type npts = fPoints.size();
-  Pvec_t selected;
-  selected.reserve( npts );
   fDof = npts-2;
   pdbl_t chi2_interval;
   if( fProjection->DoingChisqTest() )
     chi2_interval = fProjection->GetChisqLimits(fDof);
-  vector<Double_t> w(npts);
-  for( UInt_t i = 0; i < n_combinations; ++i ) {
-    NthCombination( i, fPoints, selected );
-    assert( selected.size() == npts );
+  const Double_t x0 = fCornerX[0], z0 = fZL;
+  Pvec_t selected( npts );
+  vector<Pvec_t::size_type> idx( npts, 0 );
+  vector<FitSums> sums( npts+1 );
+  Double_t bound = kBig;
+  vector<Pvec_t>::size_type k = 0;
+  while( true ) {
+    if( idx[k] == fPoints[k].size() ) {
+      // All points in this plane done: go back up one level
+      if( k == 0 )
+	break;
+      ++idx[--k];
+      continue;
+    }
+    Point* p = fPoints[k][idx[k]];
+    selected[k] = p;
+    FitSums& s = sums[k+1];
+    s = sums[k];
+    s.Add( p->x-x0, p->z-z0, 1.0/(p->res()*p->res()) );
+    Double_t chi2 = (k >= 2) ? s.Chi2() : 0.0;
+    if( chi2 > bound or k+1 < npts ) {
+      if( chi2 > bound )
+	++idx[k];  // Prune: no combination below this one can do better
+      else
+	idx[++k] = 0;
+      continue;
+    }
+    ++idx[k];
 
+    // Complete combination with chi2 below the current bound.
     // Do linear fit of the points, assuming uncorrelated measurements (x_i)
     // and different resolutions for each point.
     // We fit x = a1 + a2*z (z independent).
     // Notation from: Review of Particle Properties, PRD 50, 1277 (1994)
-    Double_t S11 = 0, S12 = 0, S22 = 0, G1 = 0, G2 = 0, chi2 = 0;
+    Double_t S11 = 0, S12 = 0, S22 = 0, G1 = 0, G2 = 0;
     UInt_t pat = 0;
 #ifdef MCDATA
     UInt_t mcpat = 0, nmcplanes = 0;
 #endif
     for( Pvec_t::size_type j = 0; j < npts; j++) {
-      Point* p = selected[j];
-      Double_t r = w[j] = 1.0 / ( p->res() * p->res() );
+      Point* q = selected[j];
+      Double_t r = 1.0 / ( q->res() * q->res() );
       S11 += r;
-      S12 += p->z * r;
-      S22 += p->z * p->z * r;
-      G1  += p->x * r;
-      G2  += p->x * p->z * r;
+      S12 += q->z * r;
+      S22 += q->z * q->z * r;
+      G1  += q->x * r;
+      G2  += q->x * q->z * r;
     }
     Double_t D   = S11*S22 - S12*S12;
     Double_t iD  = 1.0/D;
@@ -804,21 +888,22 @@ Bool_t Road::Fit()
     Double_t a2  = (G2*S11 - G1*S12)*iD;  // Slope
     // Covariance matrix of the fitted parameters
     Double_t V[3] = { S22*iD, -S12*iD, S11*iD };
+    chi2 = 0;
     for( Pvec_t::size_type j = 0; j < npts; j++) {
-      Point* p = selected[j];
-      Double_t d = a1 + a2*p->z - p->x;
-      chi2 += d*d * w[j];
+      Point* q = selected[j];
+      Double_t d = a1 + a2*q->z - q->x;
+      chi2 += d*d / ( q->res() * q->res() );
       // Must never use two points in the same plane
-      assert( p->hit->GetPlaneNum() != kMaxUInt );
-      assert( (pat & (1U << p->hit->GetPlaneNum())) == 0 );
-      pat |= 1U << p->hit->GetPlaneNum();
+      assert( q->hit->GetPlaneNum() != kMaxUInt );
+      assert( (pat & (1U << q->hit->GetPlaneNum())) == 0 );
+      pat |= 1U << q->hit->GetPlaneNum();
 #ifdef MCDATA
       if( mcdata ) {
-	MCHitInfo* mcinfo = dynamic_cast<Podd::MCHitInfo*>(p->hit);
+	MCHitInfo* mcinfo = dynamic_cast<Podd::MCHitInfo*>(q->hit);
 	assert( mcinfo );
 	// TODO: see CollectCoordinates
 	if( mcinfo->fMCTrack != 0 ) {
-	  mcpat |= 1U << p->hit->GetPlaneNum();
+	  mcpat |= 1U << q->hit->GetPlaneNum();
 	  ++nmcplanes;
 	}
       }
@@ -842,7 +927,7 @@ Bool_t Road::Fit()
       fChi2  = chi2;
       memcpy( fV, V, 3*sizeof(Double_t) );
       // Save points used for this fit
-      fFitCoord.swap( selected );
+      fFitCoord.assign( ALL(selected) );
       fPlanePattern = pat;
 #ifdef MCDATA
       if( mcdata ) {
@@ -850,10 +935,12 @@ Bool_t Road::Fit()
 	fMCTrackPlanePatternFit = mcpat;
       }
 #endif
+      bound = fChi2;
       if( fProjection->DoingChisqTest() ) {
 	// Throw out Chi2's outside of selected confidence interval
 	// NB: Obviously, this requires accurate hit resolutions
 	//TODO: keep statistics
+	bound = TMath::Min( bound, chi2_interval.second );
 	if( chi2 < chi2_interval.first )
 	  continue;
 	if( chi2 > chi2_interval.second )
@@ -867,11 +954,26 @@ Bool_t Road::Fit()
       if( fProjection->GetDebug() > 3 ) cout << "ACCEPTED" << endl;
 #endif
     }
-
-  }// for n_combinations
+  }// while combinations
 
   if( !fGood )
     fTrkStat = kNoGoodFit;
+  else {
+    // Cache the contribution of the best fit points to the normal equations
+    // of the 3D track fit (see Tracker::FitTrack), which depends only on
+    // the points and the projection angle
+    Double_t cosa = fProjection->GetCosAngle();
+    Double_t sina = fProjection->GetSinAngle();
+    fFitEq.Clear();
+    fFitYWY = 0;
+    for( Pvec_t::iterator it = fFitCoord.begin(); it != fFitCoord.end();
+	 ++it ) {
+      const Point* p = *it;
+      Double_t w = 1.0/(p->res()*p->res());
+      fFitEq.Add( cosa, cosa*p->z, sina, sina*p->z, w, p->x );
+      fFitYWY += w * p->x * p->x;
+    }
+  }
 
   return fGood;
 }
@@ -892,7 +994,8 @@ TVector2 Road::Intersect( const Road* other, Double_t z ) const
   Double_t cu = fProjection->GetCosAngle();
   Double_t sv = other->fProjection->GetSinAngle();
   Double_t cv = other->fProjection->GetCosAngle();
-  // FIXME: this should be calculated only once
+  // NB: the 3D matching code in Tracker uses precomputed coefficients
+  // (Tracker::ProjPair_t) instead of this function
   Double_t inv_denom = 1.0/(sv*cu-su*cv);
 
   // Standard formulae for the intersection of non-orthogonal coordinates
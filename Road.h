@@ -8,6 +8,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Hit.h"
+#include "NormalEq4.h"
 #include "TVector2.h"
 #include <set>
 #include <utility>
@@ -76,8 +77,8 @@ namespace TreeSearch {
         fNMCTrackHits(0), fMCTrackPlanePattern(0), fNMCTrackHitsFit(0),
         fMCTrackPlanePatternFit(0),
 #endif
-        fPos(0), fSlope(0), fChi2(0), fDof(0), fGood(false), fTrack(0),
-        fBuild(0), fGrown(false), fTrkStat(kTrackOK), fNfits(0) {} // For internal ROOT use
+        fPos(0), fSlope(0), fChi2(0), fDof(0), fFitYWY(0), fGood(false),
+        fTrack(0), fBuild(0), fGrown(false), fTrkStat(kTrackOK), fNfits(0) {} // For internal ROOT use
     Road( const Road& );
     Road& operator=( const Road& );
     virtual ~Road();
@@ -91,6 +92,8 @@ namespace TreeSearch {
     UInt_t         GetNdof()    const { return fDof; }
     const Hset_t&  GetHits()    const { return fHits; }
     const Pvec_t&  GetPoints()  const { return fFitCoord; }
+    const NormalEq4& GetFitEq() const { return fFitEq; }
+    Double_t       GetFitYWY()  const { return fFitYWY; }
     Double_t       GetPos()     const { return fPos; }
     Double_t       GetPos( Double_t z ) const { return fPos + z*fSlope; }
     Double_t       GetPosErrsq( Double_t z ) const;
@@ -123,6 +126,13 @@ namespace TreeSearch {
       { return ( a->GetPos() < b->GetPos() ); }
     };
 
+    struct Chi2IsLess
+      : public std::binary_function< Road*, Road*, bool >
+    {
+      bool operator() ( const Road* a, const Road* b ) const
+      { return ( a->GetChi2() < b->GetChi2() ); }
+    };
+
     class PosIsNear {
     public:
       explicit PosIsNear( Double_t tolerance ) : fTol(tolerance) {}
@@ -170,6 +180,8 @@ namespace TreeSearch {
     Double_t       fChi2;       // Chi2 of fit
     Double_t       fV[3];       // Covar matrix of param (V11, V12=V21, V22)
     UInt_t         fDof;        // Degrees of freedom of fit (nhits-2)
+    NormalEq4      fFitEq;      //! Contribution of best fit points to 3D fit
+    Double_t       fFitYWY;     //! Weighted sum of squares of the points
 
     Bool_t         fGood;       // Road successfully fit
     THaTrack*      fTrack;      // The lowest-chi2 3D track using this road
@@ -0,0 +1,349 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// TreeSearch::TaskPool                                                      //
+//                                                                           //
+// Simple pool of worker threads. Work is submitted as a Task with n         //
+// independent items. Items are handed out one at a time to idle workers and //
+// to the submitting thread. Handing out and completing items only takes     //
+// atomic operations on the job's counters. The mutex is only taken to       //
+// queue, dequeue and complete jobs, to pick up a queued job and to sleep.   //
+// Results should be written by the Task into per-item slots, so that the    //
+// caller can reduce them in a deterministic order afterwards. Process()     //
+// returns when all items are done. Submit() returns immediately, letting    //
+// the caller do other work until Wait().                                    //
+//                                                                           //
+// Tasks may themselves submit work (e.g. a projection being tracked         //
+// submitting its road fits). A thread waiting for its own items to finish   //
+// on other threads does not sleep as long as there is any other work        //
+// queued: it takes items from the other jobs in the meantime. Thus no       //
+// thread is tied to one kind of work, and nested submissions cannot leave   //
+// the pool idle.                                                            //
+//                                                                           //
+// Requires libThread to be loaded.                                          //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TaskPool.h"
+
+#include "TThread.h"
+#include "TCondition.h"
+#include "TMutex.h"
+#include "TString.h"
+#include "TError.h"
+
+#include <cassert>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace TreeSearch {
+
+// Job item counters are updated with atomic operations, without fMutex
+#if !defined(__GNUC__)
+#error "TaskPool requires the GCC atomic builtins (gcc >= 4.1 or clang)"
+#endif
+
+//_____________________________________________________________________________
+static inline UInt_t AtomicPeek( UInt_t* p )
+{
+  // Read *p outside of the mutex in a spin loop. A plain volatile load
+  // without a memory fence, so that spinning threads only share the cache
+  // line and the loop stays cheap. Callers must synchronize (e.g. lock the
+  // mutex) once they have seen a change.
+  return *static_cast<volatile UInt_t*>(p);
+}
+
+//_____________________________________________________________________________
+static inline UInt_t AtomicLoad( UInt_t* p )
+{
+  // Read *p outside of the mutex with acquire semantics, so that data
+  // written before *p was updated are visible afterwards
+#ifdef __ATOMIC_ACQUIRE
+  return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+#else
+  UInt_t v = *static_cast<volatile UInt_t*>(p);
+  __sync_synchronize();
+  return v;
+#endif
+}
+
+//_____________________________________________________________________________
+static inline void CpuRelax()
+{
+  // Hint to the CPU that we are in a spin-wait loop
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#endif
+}
+
+//_____________________________________________________________________________
+static Bool_t PinToCPU( Int_t cpu )
+{
+  // Restrict the calling thread to run on the given CPU only.
+  // Returns false if not supported or not possible.
+
+#ifdef __linux__
+  if( cpu < 0 or cpu >= CPU_SETSIZE )
+    return false;
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CPU_SET( cpu, &set );
+  return ( sched_setaffinity(0, sizeof(set), &set) == 0 );
+#else
+  return false;
+#endif
+}
+
+//_____________________________________________________________________________
+TaskPool::TaskPool( UInt_t nthreads, UInt_t nspin,
+		    const vector<Int_t>* cpus )
+  : fMutex(new TMutex), fChange(new TCondition(fMutex)), fTerminate(false),
+    fSeq(0), fNwaiting(0), fNspin(nspin)
+{
+  // Constructor. Start nthreads worker threads. Threads waiting for work
+  // or for completion of a job poll for up to nspin iterations before
+  // going to sleep. If cpus is given and not empty, worker i is pinned to
+  // CPU (*cpus)[i % cpus->size()]. Since each worker then allocates its
+  // working memory on its own CPU, that memory is normally placed on the
+  // worker's local NUMA node (first-touch policy).
+
+  fThreads.reserve( nthreads );
+  fWorkers.resize( nthreads );
+  fMutex->Lock();
+  for( UInt_t i = 0; i < nthreads; ++i ) {
+    Worker& w = fWorkers[i];
+    w.pool = this;
+    w.cpu  = ( cpus and !cpus->empty() ) ? (*cpus)[i % cpus->size()] : -1;
+    TThread* t = new TThread( Form("tsk_%u",i), DoWork, (void*)&w );
+    fThreads.push_back( t );
+    t->Run();
+  }
+  fMutex->UnLock();
+}
+
+//_____________________________________________________________________________
+TaskPool::~TaskPool()
+{
+  // Destructor. Terminate and join all worker threads.
+
+  fMutex->Lock();
+  assert( fQueue.empty() );
+  fTerminate = true;
+  Notify();
+  fMutex->UnLock();
+  for( vector<TThread*>::iterator it = fThreads.begin();
+       it != fThreads.end(); ++it ) {
+    (*it)->Join();
+    delete *it;
+  }
+  delete fChange;
+  delete fMutex;
+}
+
+//_____________________________________________________________________________
+inline Bool_t TaskPool::Claim( Job* job, UInt_t& i )
+{
+  // Claim the next item of the job, if any, without locking. The caller
+  // must ensure that the job stays valid (see RunItems).
+
+  i = __sync_fetch_and_add( &job->next, 1 );
+  return ( i < job->n );
+}
+
+//_____________________________________________________________________________
+void TaskPool::RunItems( Job* job, UInt_t i )
+{
+  // Process item i of the job, which the caller has claimed, and then any
+  // further items of the job that can still be claimed. Must be called with
+  // fMutex unlocked. Handing out and completing items only takes atomic
+  // operations; the mutex is needed once per job, to dequeue it and to
+  // signal its completion.
+  //
+  // The next item is claimed before the completion of the current one is
+  // counted. A thread therefore only touches a job while it holds one of
+  // its unfinished items, and the owner cannot return from Wait() and
+  // destroy the job before that. For the same reason, the thread claiming
+  // the last item removes the job from the queue before running it.
+
+  const UInt_t n = job->n;
+  while( true ) {
+    if( i+1 == n ) {
+      fMutex->Lock();
+      fQueue.remove( job );
+      fMutex->UnLock();
+    }
+    job->task->Run(i);
+    UInt_t next = __sync_fetch_and_add( &job->next, 1 );
+    if( __sync_add_and_fetch(&job->ndone, 1) == n ) {
+      fMutex->Lock();
+      Notify();
+      fMutex->UnLock();
+    }
+    if( next >= n )
+      break;
+    i = next;
+  }
+}
+
+//_____________________________________________________________________________
+Bool_t TaskPool::RunQueued()
+{
+  // Process items of the first queued job. Must be called with fMutex
+  // locked. The mutex is released while items are being processed.
+  // Returns false if there was no work queued.
+
+  while( !fQueue.empty() ) {
+    // Jobs are only dequeued with fMutex held, so this one is valid
+    Job* job = fQueue.front();
+    UInt_t i;
+    if( Claim(job, i) ) {
+      fMutex->UnLock();
+      RunItems( job, i );
+      fMutex->Lock();
+      return true;
+    }
+    // All items handed out, the last one is being dequeued
+    fQueue.pop_front();
+  }
+  return false;
+}
+
+//_____________________________________________________________________________
+void TaskPool::Notify()
+{
+  // Signal a change of state (new work, completion of a job, termination)
+  // to waiting threads. Must be called with fMutex locked. Threads that are
+  // still spinning see the new sequence number, so the condition variable
+  // only needs to be signalled if any threads are actually asleep.
+
+  __sync_add_and_fetch( &fSeq, 1 );
+  if( fNwaiting > 0 )
+    fChange->Broadcast();
+}
+
+//_____________________________________________________________________________
+void TaskPool::Block()
+{
+  // Wait for the next state change (see Notify). Must be called with fMutex
+  // locked. First spin for up to fNspin iterations with the mutex released,
+  // then sleep on the condition variable. May return spuriously, so callers
+  // must re-test their wait condition.
+
+  UInt_t seq = fSeq;
+  if( fNspin > 0 ) {
+    fMutex->UnLock();
+    for( UInt_t i = 0; i < fNspin; ++i ) {
+      if( AtomicPeek(&fSeq) != seq )
+	break;
+      CpuRelax();
+    }
+    // Locking the mutex also synchronizes with the change seen, if any
+    fMutex->Lock();
+    if( fSeq != seq )
+      return;
+  }
+  ++fNwaiting;
+#ifndef NDEBUG
+  Int_t ret =
+#endif
+    fChange->Wait();
+  assert( ret == 0 );
+  --fNwaiting;
+}
+
+//_____________________________________________________________________________
+void TaskPool::Process( Task* task, UInt_t n )
+{
+  // Run task->Run(i) for all items i = 0..n-1 and return when all are done.
+
+  assert( task );
+  if( n == 0 )
+    return;
+  if( fThreads.empty() or n == 1 ) {
+    for( UInt_t i = 0; i < n; ++i )
+      task->Run(i);
+    return;
+  }
+
+  Job job;
+  Submit( job, task, n );
+  Wait( job );
+}
+
+//_____________________________________________________________________________
+void TaskPool::Submit( Job& job, Task* task, UInt_t n )
+{
+  // Queue task->Run(i) for all items i = 0..n-1 and return immediately
+
+  assert( task );
+  job.task  = task;
+  job.n     = n;
+  job.next  = 0;
+  job.ndone = 0;
+  if( n == 0 )
+    return;
+  if( fThreads.empty() ) {
+    for( UInt_t i = 0; i < n; ++i )
+      task->Run(i);
+    job.next = job.ndone = n;
+    return;
+  }
+
+  fMutex->Lock();
+  fQueue.push_back( &job );
+  Notify();
+  fMutex->UnLock();
+}
+
+//_____________________________________________________________________________
+void TaskPool::Wait( Job& job )
+{
+  // Return when all items of the job are done
+
+  if( job.n == 0 )
+    return;
+
+  // Help process our own items while the workers are busy. The job is
+  // ours, so its items can be claimed without locking.
+  UInt_t i;
+  if( Claim(&job, i) )
+    RunItems( &job, i );
+  if( AtomicLoad(&job.ndone) == job.n )
+    return;
+  // While the remaining items are in progress elsewhere, help with any
+  // other queued work instead of waiting idly
+  fMutex->Lock();
+  while( AtomicLoad(&job.ndone) < job.n ) {
+    if( !RunQueued() )
+      Block();
+  }
+  fMutex->UnLock();
+}
+
+//_____________________________________________________________________________
+void TaskPool::DoWork( void* ptr )
+{
+  // Worker thread main loop: wait for jobs with items to hand out
+  // and process them until termination is requested.
+
+  Worker* w = reinterpret_cast<Worker*>(ptr);
+  assert( w and w->pool );
+  TaskPool* pool = w->pool;
+  if( w->cpu >= 0 and !PinToCPU(w->cpu) ) {
+    ::Warning( "TaskPool::DoWork", "Cannot pin worker thread to CPU %d",
+	       w->cpu );
+  }
+
+  pool->fMutex->Lock();
+  while( !pool->fTerminate ) {
+    if( !pool->RunQueued() )
+      pool->Block();
+  }
+  pool->fMutex->UnLock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // end namespace TreeSearch
@@ -0,0 +1,104 @@
+#ifndef ROOT_TreeSearch_TaskPool
+#define ROOT_TreeSearch_TaskPool
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// TreeSearch::TaskPool                                                      //
+//                                                                           //
+// General pool of worker threads for the tracker. Any stage of the event    //
+// processing can submit sets of independent work items to it, e.g. the     //
+// projections to be decoded or tracked, the roads of a projection to be     //
+// fit, or the rows of a 3D matching.                                        //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Rtypes.h"
+#include <vector>
+#include <list>
+
+class TThread;
+class TMutex;
+class TCondition;
+
+namespace TreeSearch {
+
+  class TaskPool {
+  public:
+    // Interface for a set of work items to be processed by the pool
+    class Task {
+    public:
+      virtual ~Task() {}
+      virtual void Run( UInt_t i ) = 0;  // Process item i
+    };
+
+    // State of a set of work items submitted with Submit(). Must stay in
+    // place until Wait() has returned.
+    class Job {
+    public:
+      Job() : task(0), n(0), next(0), ndone(0) {}
+    private:
+      friend class TaskPool;
+      Task*  task;   // Task to run
+      UInt_t n;      // Number of items
+      UInt_t next;   // Next item to hand out (atomic, may exceed n)
+      UInt_t ndone;  // Number of items finished (atomic)
+      Job( const Job& );
+      Job& operator=( const Job& );
+    };
+
+    explicit TaskPool( UInt_t nthreads, UInt_t nspin = 0,
+		       const std::vector<Int_t>* cpus = 0 );
+    ~TaskPool();
+
+    UInt_t GetNthreads() const { return fThreads.size(); }
+    // CPU that worker i is meant to be pinned to, -1 if none
+    Int_t  GetThreadCPU( UInt_t i ) const { return fWorkers[i].cpu; }
+
+    // Run task->Run(i) for i = 0..n-1 and wait until all are done.
+    // The calling thread helps process the items. Several threads may
+    // call Process() concurrently, including tasks running in the pool.
+    void   Process( Task* task, UInt_t n );
+
+    // Start running task->Run(i) for i = 0..n-1 in the background and
+    // return immediately. Wait() must be called on the job before the task
+    // or the job go away. Without worker threads, the items are run right
+    // away.
+    void   Submit( Job& job, Task* task, UInt_t n );
+    // Wait until all items of the job are done, helping to process them
+    void   Wait( Job& job );
+
+  private:
+    struct Worker {
+      TaskPool* pool;  // Pool the worker belongs to
+      Int_t     cpu;   // CPU to pin the worker to (-1 = none)
+      Worker() : pool(0), cpu(-1) {}
+    };
+
+    std::vector<TThread*> fThreads;    // Worker threads
+    std::vector<Worker>   fWorkers;    // Worker thread arguments
+    std::list<Job*>       fQueue;      // Jobs with items left to hand out
+    TMutex*               fMutex;      // Protects fQueue and fNwaiting
+    TCondition*           fChange;     // Signals new work, completion of a
+                                       // job, or termination
+    Bool_t                fTerminate;  // Workers should exit
+    UInt_t                fSeq;        // State change sequence number
+    UInt_t                fNwaiting;   // Number of threads asleep in fChange
+    UInt_t                fNspin;      // Spin iterations before sleeping
+
+    Bool_t Claim( Job* job, UInt_t& i );
+    void   RunItems( Job* job, UInt_t i );
+    Bool_t RunQueued();
+    void   Notify();
+    void   Block();
+    static void DoWork( void* ptr );
+
+    // Prevent copying
+    TaskPool( const TaskPool& );
+    TaskPool& operator=( const TaskPool& );
+  };
+
+///////////////////////////////////////////////////////////////////////////////
+
+} // end namespace TreeSearch
+
+#endif
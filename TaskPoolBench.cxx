@@ -0,0 +1,234 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// TaskPoolBench                                                             //
+//                                                                           //
+// Standalone microbenchmark of the dispatch overhead of the TaskPool,       //
+// compared to the previous per-projection thread scheme, where the main     //
+// thread broadcast a TCondition to start a batch of dedicated threads and   //
+// each thread locked a mutex and signalled a second TCondition when done.   //
+//                                                                           //
+// Each "event" dispatches nitems items of work_us busy work each and waits  //
+// for them. Reported per event are the wall time, the overhead over the     //
+// ideal parallel time, and the CPU time used by all threads together.       //
+//                                                                           //
+// Build with "make taskpoolbench". Usage:                                   //
+//   taskpoolbench [nthreads [nevents [work_us [nitems]]]]                   //
+// Defaults: 4 threads, 20000 events, 10 us per item, nitems = nthreads.     //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TaskPool.h"
+
+#include "TThread.h"
+#include "TCondition.h"
+#include "TMutex.h"
+#include "TStopwatch.h"
+#include "TString.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using TreeSearch::TaskPool;
+
+static Double_t gLoopsPerUs = 0;
+static volatile Double_t gSink = 0;
+
+//_____________________________________________________________________________
+static void BusyWork( Double_t us )
+{
+  // Spin the CPU for about 'us' microseconds
+
+  Double_t x = 0;
+  for( Long64_t i = 0, n = static_cast<Long64_t>(us*gLoopsPerUs); i < n; ++i )
+    x += 1e-9*i;
+  gSink = x;
+}
+
+//_____________________________________________________________________________
+static void Calibrate()
+{
+  // Determine the number of BusyWork loop iterations per microsecond
+
+  gLoopsPerUs = 1;
+  Double_t us = 1e6;
+  TStopwatch timer;
+  while( true ) {
+    timer.Start();
+    BusyWork( us );
+    timer.Stop();
+    if( timer.RealTime() > 0.1 )
+      break;
+    us *= 4;
+  }
+  gLoopsPerUs = us / ( 1e6*timer.RealTime() );
+}
+
+//_____________________________________________________________________________
+class BusyTask : public TaskPool::Task {
+public:
+  explicit BusyTask( Double_t us ) : fUs(us) {}
+  virtual void Run( UInt_t ) { BusyWork(fUs); }
+private:
+  Double_t fUs;
+};
+
+//_____________________________________________________________________________
+class CondDispatch {
+  // The previous dispatch scheme (Tracker's ThreadCtrl): one dedicated
+  // thread per item, started by a TCondition broadcast. Each thread
+  // clears its bit in a shared bitfield under a second mutex and signals
+  // the main thread, which sleeps until all bits are cleared.
+public:
+  CondDispatch( UInt_t nitems, Double_t us )
+    : fRunning(0), fReady(0), fUs(us), fStartM(new TMutex), fDoneM(new TMutex),
+      fStart(new TCondition(fStartM)), fDone(new TCondition(fDoneM))
+  {
+    fArgs.resize( nitems );
+    fStartM->Lock();
+    for( UInt_t i = 0; i < nitems; ++i ) {
+      fArgs[i].ctrl = this;
+      fArgs[i].bit  = 1U << i;
+      fThreads.push_back( new TThread(Form("cond_%u",i), DoWork, &fArgs[i]) );
+      fThreads.back()->Run();
+    }
+    // Each thread holds fStartM until it waits for the start condition
+    while( fReady < nitems ) {
+      fStartM->UnLock();
+      fStartM->Lock();
+    }
+    fStartM->UnLock();
+  }
+  ~CondDispatch()
+  {
+    fDoneM->Lock();
+    fStartM->Lock();
+    fRunning = kTerminate | ((1U << fArgs.size()) - 1);
+    fStart->Broadcast();
+    fStartM->UnLock();
+    while( fRunning != kTerminate )
+      fDone->Wait();
+    fDoneM->UnLock();
+    for( UInt_t i = 0; i < fThreads.size(); ++i ) {
+      fThreads[i]->Join();
+      delete fThreads[i];
+    }
+    delete fDone; delete fStart; delete fDoneM; delete fStartM;
+  }
+  void Run()
+  {
+    fDoneM->Lock();
+    fStartM->Lock();
+    fRunning = (1U << fArgs.size()) - 1;
+    fStart->Broadcast();
+    fStartM->UnLock();
+    while( fRunning != 0 )
+      fDone->Wait();
+    fDoneM->UnLock();
+  }
+private:
+  static const UInt_t kTerminate = 1U << 31;
+  struct Arg_t { CondDispatch* ctrl; UInt_t bit; };
+  static void DoWork( void* ptr )
+  {
+    Arg_t* arg = static_cast<Arg_t*>(ptr);
+    CondDispatch* c = arg->ctrl;
+    bool terminate = false;
+    c->fStartM->Lock();
+    ++c->fReady;
+    while( !terminate ) {
+      while( true ) {
+	c->fStart->Wait();
+	terminate = (c->fRunning & kTerminate);
+	if( (c->fRunning & arg->bit) or terminate )
+	  break;
+      }
+      c->fStartM->UnLock();
+      if( !terminate )
+	BusyWork( c->fUs );
+      c->fDoneM->Lock();
+      c->fRunning &= ~arg->bit;
+      if( (c->fRunning & ~kTerminate) == 0 )
+	c->fDone->Signal();
+      if( !terminate )
+	c->fStartM->Lock();
+      c->fDoneM->UnLock();
+    }
+  }
+
+  volatile UInt_t   fRunning;
+  volatile UInt_t   fReady;
+  Double_t          fUs;
+  TMutex*           fStartM;
+  TMutex*           fDoneM;
+  TCondition*       fStart;
+  TCondition*       fDone;
+  vector<Arg_t>     fArgs;
+  vector<TThread*>  fThreads;
+};
+
+//_____________________________________________________________________________
+static void Report( const char* name, TStopwatch& timer, UInt_t nevents,
+		    Double_t ideal )
+{
+  Double_t real = 1e6*timer.RealTime()/nevents;
+  Double_t cpu  = 1e6*timer.CpuTime()/nevents;
+  printf( "%-18s %10.2f %10.2f %10.2f\n", name, real, real-ideal, cpu );
+}
+
+//_____________________________________________________________________________
+int main( int argc, char** argv )
+{
+  UInt_t   nthreads = ( argc > 1 ) ? atoi(argv[1]) : 4;
+  UInt_t   nevents  = ( argc > 2 ) ? atoi(argv[2]) : 20000;
+  Double_t work_us  = ( argc > 3 ) ? atof(argv[3]) : 10;
+  UInt_t   nitems   = ( argc > 4 ) ? atoi(argv[4]) : nthreads;
+  if( nthreads == 0 or nevents == 0 or nitems == 0 ) {
+    fprintf( stderr, "Usage: %s [nthreads [nevents [work_us [nitems]]]]\n",
+	     argv[0] );
+    return 1;
+  }
+
+  Calibrate();
+  UInt_t nrounds = (nitems+nthreads-1)/nthreads;
+  Double_t ideal = nrounds*work_us;
+  printf( "%u threads, %u events, %u items of %g us per event, "
+	  "ideal %g us/event\n", nthreads, nevents, nitems, work_us, ideal );
+  printf( "%-18s %10s %10s %10s\n", "scheme", "real(us)", "overhead",
+	  "cpu(us)" );
+
+  TStopwatch timer;
+  BusyTask task( work_us );
+
+  // Serial reference
+  timer.Start();
+  for( UInt_t ev = 0; ev < nevents; ++ev )
+    for( UInt_t i = 0; i < nitems; ++i )
+      task.Run(i);
+  timer.Stop();
+  Report( "serial", timer, nevents, ideal );
+
+  // Previous scheme: dedicated thread per item (as many as fit in a bitfield)
+  if( nitems < 32 ) {
+    CondDispatch cond( nitems, work_us );
+    timer.Start();
+    for( UInt_t ev = 0; ev < nevents; ++ev )
+      cond.Run();
+    timer.Stop();
+    Report( "condition", timer, nevents, ideal );
+  }
+
+  // Task pool with different spin counts. The caller is one of the threads
+  const UInt_t spins[] = { 0, 100, 1000, 4000, 20000 };
+  for( UInt_t k = 0; k < sizeof(spins)/sizeof(spins[0]); ++k ) {
+    TaskPool pool( nthreads-1, spins[k] );
+    timer.Start();
+    for( UInt_t ev = 0; ev < nevents; ++ev )
+      pool.Process( &task, nitems );
+    timer.Stop();
+    Report( Form("pool spin=%u",spins[k]), timer, nevents, ideal );
+  }
+
+  return 0;
+}
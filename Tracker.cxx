@@ -19,6 +19,8 @@
 #include "Projection.h"
 #include "Road.h"
 #include "Helper.h"
+#include "TaskPool.h"
+#include "NormalEq4.h"
 
 #include "THaDetMap.h"
 #include "THaTrack.h"
@@ -27,11 +29,7 @@
 #include "TMath.h"
 #include "THashTable.h"
 #include "TVector2.h"
-#include "TDecompChol.h"
 #include "TSystem.h"
-#include "TThread.h"
-#include "TCondition.h"
-#include "TMutex.h"
 #include "TBits.h"
 #include "TClass.h"
 
@@ -40,6 +38,7 @@
 #include <numeric>
 #include <map>
 #include <string>
+#include <sstream>
 #include <stdexcept>
 #include <cstring>   // for memset
 
@@ -135,6 +134,10 @@ const Double_t kBig = 1e38;
 // Default value for minimum difference between all projection angles
 static const Double_t kMinProjAngleDiff = 5.0 * TMath::DegToRad();
 
+// Default spin iterations of idle pool threads (about 20 us on a recent
+// x86 CPU), used if each thread can have a CPU of its own. See TaskPoolBench
+static const UInt_t kPoolAutoSpin = 1000;
+
 #ifdef MCDATA
 // Reconstruction status bit numbers, for evaluating tracking with MC data
 enum EReconBits {
@@ -167,204 +170,191 @@ struct ProjAngle_t {
 };
 
 //_____________________________________________________________________________
-// Support classes for data-processing threads
-
-struct TrackThread {
-  Projection*  proj;    // Projection to be processed
-  Int_t*       status;  // Return status (shared)
-  UInt_t*      running; // Bitfield indicating threads to wait for (shared)
-  TMutex*      start_m; // Mutex for start condition
-  TMutex*      done_m;  // Mutex for done condition
-  TCondition*  start;   // Start condition of tracking threads
-  TCondition*  done;    // Condition indicating all tracking threads done
-  TThread*     thread;  // The actual thread running with these arguments
-  TrackThread()
-    : proj(0), status(0), running(0), start_m(0), done_m(0),
-      start(0), done(0), thread(0) {}
-  ~TrackThread() {
-    if( thread ) {
-      TThread::Delete(thread);
-      delete thread;
-    }
+// Tasks for processing the projections in parallel on the worker pool
+
+class ProjDecodeTask : public TaskPool::Task {
+  // Decode the planes of each projection and, if requested, fill its
+  // hitpattern. The number of decoded hits is recorded per projection.
+public:
+  ProjDecodeTask( const vector<Projection*>& proj, const THaEvData& evdata,
+		  Bool_t fill, vector<Int_t>& nhits )
+    : fProj(proj), fEvdata(evdata), fFill(fill), fNhits(nhits) {}
+  virtual void Run( UInt_t i )
+  {
+    Projection* proj = fProj[i];
+    fNhits[i] = proj->Decode( fEvdata );
+    // Sanity cut on overfull planes. nhits < 0 indicates overflow
+    if( fNhits[i] >= 0 and fFill )
+      proj->FillHitpattern();
   }
+private:
+  const vector<Projection*>& fProj;
+  const THaEvData&  fEvdata;
+  Bool_t            fFill;
+  vector<Int_t>&    fNhits;
 };
 
 //_____________________________________________________________________________
-class ThreadCtrl {
+class Tracker::StagedTrack : public TaskPool::Task {
+  // Tracking of all projections, scheduled on the worker pool as a graph
+  // of dependent tasks. The road search of each projection (tree search
+  // and MakeRoads) is one item of the search job. As soon as a projection
+  // has its roads, their fits are queued as a job of their own, so idle
+  // threads can take over the fits of a busy projection while the others
+  // are still searching. Finish() waits for all fits and collects the
+  // results of each projection in road order.
 public:
-  explicit ThreadCtrl( const vector<Projection*>& vp )
-    : fTrackStatus(0), fTrackToDo(0),
-      fTrackStartM(new TMutex), fTrackDoneM(new TMutex),
-      fTrackStart(new TCondition(fTrackStartM)),
-      fTrackDone(new TCondition(fTrackDoneM))
+  StagedTrack( const vector<Projection*>& proj, TaskPool* pool )
+    : fProj(proj), fPool(pool), fNroads(proj.size()),
+      fFits(new RoadFits[proj.size()]), fPending(false)
   {
-    if( !vp.empty() ) {
-      fTrack.reserve( vp.size() );
-      fTrackStartM->Lock();
-      for( vpsiz_t k = 0; k < vp.size(); ++k ) {
-	TThread* t = AddTrackThread( vp[k] );
-	t->Run();
+    for( vpsiz_t k = 0; k < fProj.size(); ++k )
+      fFits[k].proj = fProj[k];
+  }
+  virtual ~StagedTrack() { Finish(); delete [] fFits; }
+
+  Bool_t IsPending() const { return fPending; }
+  const vector<Int_t>& GetNroads() const { return fNroads; }
+
+  void Start()
+  {
+    // Queue the road searches and return immediately
+    assert( !fPending );
+    fPending = true;
+    fPool->Submit( fSearch, this, fProj.size() );
+  }
+
+  void Finish()
+  {
+    // Wait for all stages to finish and collect the fit results. Leaves
+    // the Track() result of each projection in fNroads.
+    if( !fPending )
+      return;
+    fPool->Wait( fSearch );
+    for( vpsiz_t k = 0; k < fProj.size(); ++k ) {
+      RoadFits& fits = fFits[k];
+      if( fits.queued ) {
+	fPool->Wait( fits.job );
+	fits.queued = false;
       }
-      fTrackStartM->UnLock();
+      if( fNroads[k] > 0 )
+	fProj[k]->CollectRoadFits( fits.good );
+      fNroads[k] = fProj[k]->EndTrack( fNroads[k], fits.t_fit, fits.t_track );
     }
+    fPending = false;
   }
 
-  //___________________________________________________________________________
-  ~ThreadCtrl()
+  virtual void Run( UInt_t k )
   {
-    // Terminate all running tracking threads
-    if( !fTrack.empty() ) {
-      fTrackDoneM->Lock();
-      fTrackStartM->Lock();
-      fTrackToDo = 0;
-      for( vector<TrackThread>::iterator it = fTrack.begin(); it !=
-	     fTrack.end(); ++it ) {
-	TThread* th = it->thread;
-	if( th and th->GetState() == TThread::kRunningState )
-	  SETBIT(fTrackToDo, it->proj->GetType());
-      }
-      // MSB is termination flag
-      SETBIT(fTrackToDo, kThreadTerminateBit);
-      fTrackStart->Broadcast();
-      fTrackStartM->UnLock();
-      while( true ) {
-#ifndef NDEBUG
-	Int_t ret =
+    // Road search of projection k. Queues the road fits as a new job if
+    // there are enough roads to make this worthwhile, else fits them here.
+    Projection* proj = fProj[k];
+    RoadFits& fits = fFits[k];
+#ifdef TESTCODE
+    fits.timer_tot.Start();
 #endif
-	  fTrackDone->Wait();
-	assert( ret == 0 );
-	if( fTrackToDo == BIT(kThreadTerminateBit) )
-	  break;
-      }
-      fTrackDoneM->UnLock();
+    Int_t nroads = fNroads[k] = proj->FindRoads();
+    if( nroads <= 0 )
+      return;
+    fits.good.assign( nroads, 0 );
+#ifdef TESTCODE
+    fits.ndone = 0;
+    fits.timer.Start();
+#endif
+    if( (UInt_t)nroads >= proj->GetMinParallelRoads() ) {
+      fits.queued = true;
+      fPool->Submit( fits.job, &fits, nroads );
+    } else {
+      for( Int_t i = 0; i < nroads; ++i )
+	fits.Run(i);
     }
-    // At this point, all threads should have released their condition
-    // waits and mutexes, so clean up is safe
-    delete fTrackDone;
-    delete fTrackStart;
-    delete fTrackDoneM;
-    delete fTrackStartM;
   }
 
-  //___________________________________________________________________________
-  Int_t Run( UInt_t maxthreads )
-  {
-    // Run our threads, at most maxthreads at a time
-    if( maxthreads == 0 or fTrack.empty() )
-      return 0;
-    if( maxthreads > kThreadTerminateBit )
-      maxthreads = kThreadTerminateBit;
-    fTrackDoneM->Lock();
-    fTrackStatus = 0;
-    vector<TrackThread>::iterator it = fTrack.begin();
-    while( it != fTrack.end() ) {
-      fTrackStartM->Lock();
-      fTrackToDo = 0;
-      UInt_t n = 0;
-      while( n < maxthreads and it != fTrack.end() ) {
-	SETBIT(fTrackToDo, it->proj->GetType());
-	++n;
-	++it;
+private:
+  struct RoadFits : public TaskPool::Task {
+    // Fits of the roads of one projection. With TESTCODE, the thread
+    // finishing the last fit records the fit time and the total tracking
+    // time of the projection, as Projection::Track() does.
+    RoadFits() : proj(0), queued(false), t_fit(0), t_track(0), ndone(0) {}
+    virtual void Run( UInt_t i )
+    {
+      good[i] = proj->GetRoad(i)->Fit();
+#ifdef TESTCODE
+      if( __sync_add_and_fetch(&ndone, 1) == good.size() ) {
+	t_fit   = 1e6*timer.RealTime();
+	t_track = 1e6*timer_tot.RealTime();
       }
-      // Start tracking within the threads
-      fTrackStart->Broadcast();
-      fTrackStartM->UnLock();
-      while( true ) {
-	// Wait for end of processing
-#ifndef NDEBUG
-	Int_t ret =
 #endif
-	  fTrackDone->Wait();
-	assert( ret == 0 );
-	if( fTrackToDo == 0 )
-	  break;
-      }
     }
-    fTrackDoneM->UnLock();
-    return fTrackStatus;
-  }
+    Projection*     proj;
+    vector<Int_t>   good;    // Fit() result per road
+    TaskPool::Job   job;
+    Bool_t          queued;  // Job submitted, not yet waited for
+    Double_t        t_fit, t_track; // Stage times in us (TESTCODE)
+    UInt_t          ndone;   // Number of fits finished (TESTCODE)
+#ifdef TESTCODE
+    TStopwatch      timer, timer_tot;
+#endif
+  };
 
-  //___________________________________________________________________________
-  static void DoTrack( void* ptr )
-  {
-    TrackThread* arg = reinterpret_cast<TrackThread*>(ptr);
+  const vector<Projection*>& fProj;
+  TaskPool*         fPool;
+  vector<Int_t>     fNroads;   // FindRoads()/Track() result per projection
+  RoadFits*         fFits;     // Array of road fits per projection
+  TaskPool::Job     fSearch;   // Road search job
+  Bool_t            fPending;  // Started, but not yet finished
 
-    //  TThread::SetCancelOn();
-    bool terminate = false;
-    arg->start_m->Lock();
-    while( !terminate ) {
+  StagedTrack( const StagedTrack& );
+  StagedTrack& operator=( const StagedTrack& );
+};
 
-      // Wait for start condition
-      while( true ) {
-#ifndef NDEBUG
-	Int_t ret =
-#endif
-	  arg->start->Wait(); // unlocks arg->start_m
-	assert( ret == 0 );
-	terminate = TESTBIT(*arg->running, kThreadTerminateBit);
-	if( TESTBIT(*arg->running, arg->proj->GetType()) or terminate )
-	  break;
-      }
-      arg->start_m->UnLock();
-
-      Int_t nrd = 0;
-      if( !terminate )
-	// Process this event
-	nrd = arg->proj->Track();
-
-      // Ensure we're the only one modifying/testing thread
-      // control data (arg->running)
-      arg->done_m->Lock();
-      // Set error flag, if necessary
-      if( nrd < 0 ) {
-	*arg->status = 1;
-      }
-      // Clear the bit for this projection in the status bitfield
-      CLRBIT( *arg->running, arg->proj->GetType() );
-      // If all bits are zero, all threads have finished processing,
-      // in which case we wake up the main thread
-      if( (*arg->running & ~BIT(kThreadTerminateBit)) == 0 )
-	arg->done->Signal();
-
-      if( !terminate )
-	// Ensure that we enter Wait() before the main thread can send the
-	// next Broadcast(). This must come before unlocking arg->done_m,
-	// or else we have a race condition in the main thread.
-	arg->start_m->Lock();
-
-      arg->done_m->UnLock();
+//_____________________________________________________________________________
+static Int_t ParseCPUList( const string& str, vector<Int_t>& cpus )
+{
+  // Parse a list of CPU numbers and ranges like "0-3,8,10-11" into cpus.
+  // An empty string gives an empty list. Returns 0 on success, 1 on error.
+
+  cpus.clear();
+  istringstream is( str );
+  string item;
+  while( getline(is, item, ',') ) {
+    if( item.find_first_not_of(" \t") == string::npos )
+      continue;
+    Int_t lo = -1, hi = -1;
+    char dash = 0;
+    istringstream is_item( item );
+    is_item >> lo;
+    if( !is_item )
+      return 1;
+    hi = lo;
+    if( is_item >> dash ) {
+      char extra;
+      if( dash != '-' or !(is_item >> hi) or (is_item >> extra) )
+	return 1;
     }
+    if( lo < 0 or hi < lo )
+      return 1;
+    for( Int_t cpu = lo; cpu <= hi; ++cpu )
+      cpus.push_back( cpu );
   }
+  return 0;
+}
 
-  static UInt_t GetMaxThreads() { return kThreadTerminateBit; }
-
-private:
-  static const UInt_t kThreadTerminateBit = 8*sizeof(UInt_t)-1; // = 31
+//_____________________________________________________________________________
+static Int_t GetNumaNode( Int_t cpu )
+{
+  // NUMA node of the given CPU, -1 if unknown. Uses Linux sysfs.
 
-  TThread* AddTrackThread( Projection* proj ) {
-    assert( proj );
-    fTrack.push_back( TrackThread() );
-    TrackThread* t = &fTrack.back();
-    t->proj    = proj;
-    t->status  = &fTrackStatus;
-    t->running = &fTrackToDo;
-    t->start_m = fTrackStartM;
-    t->done_m  = fTrackDoneM;
-    t->start   = fTrackStart;
-    t->done    = fTrackDone;
-    string tn;
-    tn = "trk_"; tn.append( proj->GetName() );
-    t->thread  = new TThread( tn.c_str(), DoTrack, (void*)t );
-    return t->thread;
-  }
-  vector<TrackThread>  fTrack;        // Tracking thread descriptors
-  Int_t                fTrackStatus;  // Common status variable
-  UInt_t               fTrackToDo;    // Bitfield of threads to wait for
-  TMutex*              fTrackStartM;  // Mutex for start condition
-  TMutex*              fTrackDoneM;   // Mutex for done condition
-  TCondition*          fTrackStart;   // Start condition
-  TCondition*          fTrackDone;    // Finish condition
-};
+  if( cpu < 0 )
+    return -1;
+  for( Int_t node = 0; node < 64; ++node ) {
+    // AccessPathName returns false if the path exists
+    if( !gSystem->AccessPathName(
+	  Form("/sys/devices/system/cpu/cpu%d/node%d", cpu, node)) )
+      return node;
+  }
+  return -1;
+}
 
 //====================== Tracker class ========================================
 
@@ -372,10 +362,14 @@ private:
 Tracker::Tracker( const char* name, const char* desc, THaApparatus* app )
   : THaTrackingDetector(name,desc,app), fCrateMap(0),
     fMinProjAngleDiff(kMinProjAngleDiff), fIsRotated(false),
-    fAllPartnered(false), fMaxThreads(1), fThreads(0),
+    fAllPartnered(false), fMaxThreads(1), fPool(0), fPipeline(false),
+    fPoolSpin(0), fStagedTrack(0),
     fMinReqProj(3), f3dMatchvalScalefact(1), f3dMatchCut(0),
-    fMinNdof(1), fTrkStat(kTrackOK),
-    fNcombos(0), fN3dFits(0), fEvNum(0),
+    f3dMaxCombos(kMaxUInt), f3dNbestRoads(10), f3dMinParallelPairs(10000),
+    f3dExactMaxTuples(0), f3dExactMaxNodes(100000),
+    fFrontZ(0), fBackZ(0),
+    fMinNdof(1), fTrkStat(kTrackOK), fNexactNodes(0), fExactLimit(0),
+    fNexactLimit(0), fNcombos(0), fN3dFits(0), fEvNum(0),
     t_track(0), t_3dmatch(0), t_3dfit(0), t_coarse(0)
 #ifdef MCDATA
   , fMCDecoder(0), fMCPointUpdater(0), fChecked(false)
@@ -394,7 +388,8 @@ Tracker::~Tracker()
   if (fIsSetup)
     RemoveVariables();
 
-  delete fThreads;
+  delete fStagedTrack;
+  delete fPool;
   if( fMaxThreads > 1 )
     gSystem->Unload("libThread");
 
@@ -409,6 +404,8 @@ Tracker::~Tracker()
 //_____________________________________________________________________________
 Int_t Tracker::Begin( THaRunBase* run )
 {
+  fNexactLimit = 0;
+
 #ifdef TESTCODE
   for( vrsiz_t iplane = 0; iplane < fPlanes.size(); ++iplane )
     fPlanes[iplane]->Begin(run);
@@ -422,6 +419,10 @@ void Tracker::Clear( Option_t* opt )
   // Clear event-by-event data, including those of the planes and projections
   THaTrackingDetector::Clear(opt);
 
+  // Projection tracking started in the previous event's Decode must be
+  // finished before clearing (normally done in CoarseTrack)
+  FinishAsyncTrack();
+
   // Clear the planes and projections, but only if we're not called from Init()
   if( !opt or *opt != 'I' ) {
     for( vrsiz_t iplane = 0; iplane < fPlanes.size(); ++iplane )
@@ -437,6 +438,8 @@ void Tracker::Clear( Option_t* opt )
 
   // Clear tracking status
   fTrkStat = kTrackOK;
+  fNexactNodes = 0;
+  fExactLimit = 0;
 
 #ifdef MCDATA
   fMCHitBits.clear();
@@ -487,23 +490,25 @@ Int_t Tracker::Decode( const THaEvData& evdata )
   }
 #endif
 
-  // Decode the planes, then fill the hitpatterns in the projections
-  //TODO: multithread?
-  for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it ) {
-    Projection* theProj = *it;
-    Int_t nhits = theProj->Decode( evdata );
+  // Decode the planes, then fill the hitpatterns in the projections (if
+  // doing tracking). With a worker pool, the projections are processed
+  // in parallel.
+  vector<Int_t> nhits( fProj.size() );
+  ProjDecodeTask decode( fProj, evdata, TestBit(kDoCoarse), nhits );
+  if( fPool )
+    fPool->Process( &decode, fProj.size() );
+  else {
+    for( vpsiz_t k = 0; k < fProj.size(); ++k )
+      decode.Run(k);
+  }
+  for( vpsiz_t k = 0; k < fProj.size(); ++k ) {
 #ifdef MCDATA
     if( mcdata )
-      mchitcount[theProj->GetType()].min = theProj->GetMinFitPlanes();
+      mchitcount[fProj[k]->GetType()].min = fProj[k]->GetMinFitPlanes();
 #endif
     // Sanity cut on overfull planes. nhits < 0 indicates overflow
-    if( nhits < 0 ) {
+    if( nhits[k] < 0 )
       fTrkStat = kTooManyRawHits;
-      continue;
-    }
-    // Fill the hitpattern if doing tracking
-    if( TestBit(kDoCoarse) )
-      theProj->FillHitpattern();
   }
 
 #ifdef MCDATA
@@ -553,6 +558,13 @@ Int_t Tracker::Decode( const THaEvData& evdata )
   }
 #endif
 
+  // In pipelined mode, start tracking the projections in the background.
+  // This overlaps with the decoding of the other detectors. CoarseTrack
+  // collects the results.
+  if( fPipeline and fStagedTrack and fTrkStat == kTrackOK and
+      TestBit(kDoCoarse) )
+    fStagedTrack->Start();
+
   return 0;
 }
 
@@ -704,8 +716,7 @@ Int_t Tracker::FitMCPoints( MCTrack* mctrk ) const
   }
 
   // Mimic the fit procedure used in FitTrack, except for the weighting
-  TMatrixDSym AtA(4);
-  TVectorD Aty(4);
+  NormalEq4 eq;
 
   // Fill fit matrixes
   Int_t npoints = 0;
@@ -722,29 +733,14 @@ Int_t Tracker::FitMCPoints( MCTrack* mctrk ) const
     Double_t sina = proj->GetSinAngle();
     Double_t x = hitpos.X()*cosa + hitpos.Y()*sina;
     Double_t z = hitpos.Z();
-    Double_t Ai[4] = { cosa, cosa*z, sina, sina*z };
-    for( int j = 0; j<4; ++j ) {
-      for( int k = j; k<4; ++k ) {
-	AtA(j,k) += Ai[j] * Ai[k];
-      }
-      Aty(j) += Ai[j] * x;
-    }
+    eq.Add( cosa, cosa*z, sina, sina*z, 1.0, x );
     ++npoints;
   }
   assert( npoints > 4 );  // assured by caller
 
-  for( int j = 0; j<4; ++j )
-    for( int k = j+1; k<4; ++k )
-      AtA(k,j) = AtA(j,k);
-
-  // Solve the normal equations
-  TDecompChol chol(AtA);
-  Bool_t ok = chol.Solve(Aty);
-  if( !ok ) return -1;
-
-  // Results are here, in order x, x', y, y'
-  assert( Aty.GetNrows() == 4 );
-  Double_t* coef = Aty.GetMatrixArray();
+  // Solve the normal equations. Results are in order x, x', y, y'
+  Double_t coef[NormalEq4::kNpar];
+  if( !eq.Solve(coef) ) return -1;
 
   // Calculate chi2
   //FIXME: too much code duplication here somehow
@@ -799,6 +795,11 @@ Int_t Tracker::FitMCPoints( MCTrack* mctrk ) const
 //_____________________________________________________________________________
 Int_t Tracker::End( THaRunBase* run )
 {
+  if( fNexactLimit > 0 )
+    Warning( Here("End"), "Exact 3D track selection reached the node limit "
+	     "(3d_exactmaxnodes = %u) in %u events. The best solutions found "
+	     "up to the limit were used.", f3dExactMaxNodes, fNexactLimit );
+
 #ifdef TESTCODE
   for( vrsiz_t iplane = 0; iplane < fPlanes.size(); ++iplane )
     fPlanes[iplane]->End(run);
@@ -840,57 +841,36 @@ public:
 #endif
 
 //_____________________________________________________________________________
-class FillFitMatrix
+static Int_t AddRoadFitEqs( Road* const* first, Road* const* last,
+			    NormalEq4& eq, Double_t& ywy )
 {
-public:
-  FillFitMatrix( TMatrixDSym& AtA, TVectorD& Aty )
-    : fAtA(AtA), fAty(Aty), fNpoints(0)
-  {
-    assert( fAtA.GetNrows() == 4 && fAty.GetNrows() == 4 );
-  }
+  // Add the normal equations of the 3D track fit for the points of the
+  // given roads, as cached by Road::Fit. ywy is incremented by the weighted
+  // sum of squares of the point coordinates, needed for the chi2.
+  // Returns the number of points.
 
-  void operator() ( Road* rd, Road::Point* p, const vector<Double_t>& )
-  {
-    const Projection* proj = rd->GetProjection();
-    Double_t cosa = proj->GetCosAngle();
-    Double_t sina = proj->GetSinAngle();
-    Double_t Ai[4] = { cosa, cosa * p->z, sina, sina * p->z };
-    Double_t s2 = 1.0/(p->res()*p->res());
-    for( int j = 0; j<4; ++j ) {
-      for( int k = j; k<4; ++k ) {
-	fAtA(j,k) += Ai[j] * s2 * Ai[k];
-      }
-      fAty(j) += Ai[j] * s2 * p->x;
-    }
-    ++fNpoints;
+  Int_t npoints = 0;
+  for( ; first != last; ++first ) {
+    const Road* rd = *first;
+    assert( rd->IsGood() );
+    eq += rd->GetFitEq();
+    ywy += rd->GetFitYWY();
+    npoints += rd->GetPoints().size();
   }
-  Int_t GetNpoints() const { return fNpoints; }
-private:
-  TMatrixDSym& fAtA;
-  TVectorD&    fAty;
-  Int_t        fNpoints;
-};
+  return npoints;
+}
 
 //_____________________________________________________________________________
-class CalcChisquare
+static inline Double_t FitChi2( Double_t ywy, const Double_t* b,
+				const Double_t* x )
 {
-public:
-  CalcChisquare() : fChi2(0) {}
-  void operator() ( Road* rd, Road::Point* p, const vector<Double_t>& coef )
-  {
-    const Projection* proj = rd->GetProjection();
-    Double_t cosa  = proj->GetCosAngle();
-    Double_t sina  = proj->GetSinAngle();
-    Double_t slope = coef[1]*cosa + coef[3]*sina;
-    Double_t pos   = coef[0]*cosa + coef[2]*sina + slope*p->z;
-    Double_t diff  = (pos - p->x) / p->res();
-    fChi2 += diff*diff;
-  }
-  void     Clear() { fChi2 = 0; }
-  Double_t GetResult() const { return fChi2; }
-private:
-  Double_t fChi2;
-};
+  // Chi2 of a linear least-squares fit from the quadratic form
+  // yt W y - 2 xt At W y + xt At W A x = yt W y - xt At W y,
+  // since At W A x = At W y at the minimum
+
+  Double_t chi2 = ywy - (x[0]*b[0] + x[1]*b[1] + x[2]*b[2] + x[3]*b[3]);
+  return ( chi2 > 0 ) ? chi2 : 0;
+}
 
 //_____________________________________________________________________________
 // Set bit for the unique number (fDefinedNum) of the plane of the given point
@@ -973,7 +953,7 @@ Int_t Tracker::FitTrack( const Rvec_t& roads, vector<Double_t>& coef,
   //
   // This is a much streamlined version of ROOT's TLinearFitter that solves
   // the normal equations with weights, (At W A) b = (At W) y, where AWb = Wy,
-  // using Cholesky decomposition, TDecompChol. The model used is
+  // using Cholesky decomposition, NormalEq4. The model used is
   //   y_i = P_i * T_i
   //       = ( x + z_i * mx, y + z_i * my) * ( cos(a_i), sin(a_i) )
   // where
@@ -1002,33 +982,25 @@ Int_t Tracker::FitTrack( const Rvec_t& roads, vector<Double_t>& coef,
   // The return value is the number of degrees of freedom of the fit, i.e.
   // npoints-4 > 0, or negative if too few points or matrix inversion error
 
-  // Fill the (At W A) matrix and (At W y) vector with the measured points
-  TMatrixDSym AtA(4);
-  TVectorD Aty(4);
-  FillFitMatrix f = ForAllTrackPoints(roads, coef, FillFitMatrix(AtA, Aty));
-
-  Int_t npoints = f.GetNpoints();
+  // Set up the (At W A) matrix and (At W y) vector from the contributions
+  // of the measured points, cached by each road
+  NormalEq4 eq;
+  Double_t ywy = 0;
+  assert( !roads.empty() );
+  Int_t npoints = AddRoadFitEqs( &roads[0], &roads[0]+roads.size(), eq, ywy );
   assert( npoints > 4 );
   if( npoints <=4 ) return -1; // Meaningful fit not possible
 
-  // FillFitMatrix only fills the upper triangle for efficiency
-  //TODO: make a function of FillFitMatrix?
-  for( int j = 0; j<4; ++j )
-    for( int k = j+1; k<4; ++k )
-      AtA(k,j) = AtA(j,k);
-
-  // Invert the characteristic matrix and solve the normal equations.
-  // As in ROOT's TLinearFitter, we use a Cholesky decomposition
-  // to do this (since AtA is symmetric and positive-definite).
-  // For more speed but less accuracy, one could use TMatrixDSymCramerInv.
-  TDecompChol chol(AtA);
-  Bool_t ok = chol.Solve(Aty);
+  // Solve the normal equations. As in ROOT's TLinearFitter, we use a
+  // Cholesky decomposition to do this (since AtA is symmetric and
+  // positive-definite), here the fixed-size version of NormalEq4.
+  Double_t x[NormalEq4::kNpar];
+  Bool_t ok = eq.Solve(x);
   assert(ok);
   if( !ok ) return -2; //Urgh, decomposition failed. Should never happen
 
   // Copy results to output vector in order x, x', y, y'
-  assert( Aty.GetNrows() == 4 );
-  coef.assign( Aty.GetMatrixArray(), Aty.GetMatrixArray()+Aty.GetNrows() );
+  coef.assign( x, x+NormalEq4::kNpar );
 
 #ifdef VERBOSE
   if( fDebug > 2 ) {
@@ -1038,15 +1010,15 @@ Int_t Tracker::FitTrack( const Rvec_t& roads, vector<Double_t>& coef,
 #endif
 
   // Calculate chi2
-  chi2 = ForAllTrackPoints(roads, coef, CalcChisquare()).GetResult();
+  chi2 = FitChi2( ywy, eq.GetVector(), x );
 
   // Calculate covariance matrix of the parameters, if requested
   if( coef_covar ) {
     if( coef_covar->GetNrows() != 4 )
       coef_covar->ResizeTo(4,4);
-    Bool_t ok = chol.Invert(*coef_covar);
-    assert(ok);
-    if( !ok ) return -3; // Urgh, inversion failed. Should never happen
+    Double_t cov[NormalEq4::kNpar*NormalEq4::kNpar];
+    eq.Invert( cov );
+    coef_covar->SetMatrixArray( cov );
   }
 
 #ifdef VERBOSE
@@ -1060,6 +1032,128 @@ Int_t Tracker::FitTrack( const Rvec_t& roads, vector<Double_t>& coef,
   return npoints-4;
 }
 
+//_____________________________________________________________________________
+class Tracker::TrackFitTask : public TaskPool::Task {
+  // Fit chunks of kChunk road combinations in parallel
+public:
+  static const UInt_t kChunk = 1024;
+  TrackFitTask( const Tracker* tracker, const Combos_t& combos,
+		vector<FitRes_t>& fits )
+    : fTracker(tracker), fCombos(combos), fFits(fits) {}
+  virtual void Run( UInt_t i )
+  {
+    UInt_t first = i*kChunk;
+    UInt_t last  = TMath::Min( first+kChunk, UInt_t(fCombos.size()) );
+    fTracker->FitTrackRange( fCombos, first, last, fFits );
+  }
+private:
+  const Tracker*     fTracker;
+  const Combos_t&    fCombos;
+  vector<FitRes_t>&  fFits;
+};
+
+//_____________________________________________________________________________
+void Tracker::FitTracks( const Combos_t& combos, vector<FitRes_t>& fits ) const
+{
+  // Fit all the given road combinations, like FitTrack (without covariance
+  // matrix). Results are in fits, one per combination, with ndof < 0 for
+  // failed fits. Large numbers of combinations are fit in parallel in
+  // chunks on the worker pool, unless printing debug output.
+
+  UInt_t n = combos.size();
+  fits.resize( n );
+  UInt_t nchunks = (n + TrackFitTask::kChunk - 1)/TrackFitTask::kChunk;
+  if( fPool and nchunks > 1 and fDebug <= 1 ) {
+    TrackFitTask task( this, combos, fits );
+    fPool->Process( &task, nchunks );
+  } else
+    FitTrackRange( combos, 0, n, fits );
+}
+
+//_____________________________________________________________________________
+void Tracker::FitTrackRange( const Combos_t& combos, UInt_t first,
+			     UInt_t last, vector<FitRes_t>& fits ) const
+{
+  // Fit the road combinations first..last-1, like FitTrack (without
+  // covariance matrix). Results are in the corresponding elements of fits,
+  // which must already have the size of combos, with ndof < 0 for failed
+  // fits. The normal equations of all these combinations are solved in one
+  // batch by SolveNormalEq4.
+
+  assert( first <= last and last <= combos.size() and
+	  fits.size() == combos.size() );
+  UInt_t n = last-first;
+  if( n == 0 )
+    return;
+
+  // Normal equations of all fits in structure-of-arrays layout
+  const UInt_t nA = NormalEq4::kNpacked, nb = NormalEq4::kNpar;
+  vector<Double_t> store( (nA+2*nb)*n );
+  const Double_t* a[nA];
+  const Double_t* b[nb];
+  Double_t* x[nb];
+  for( UInt_t k = 0; k < nA; ++k )
+    a[k] = &store[k*n];
+  for( UInt_t k = 0; k < nb; ++k ) {
+    b[k] = &store[(nA+k)*n];
+    x[k] = &store[(nA+nb+k)*n];
+  }
+  vector<UChar_t> ok( n );
+  vec_uint_t npoints( n );
+
+  vector<Double_t> ywy( n, 0.0 );
+  for( UInt_t i = 0; i < n; ++i ) {
+    // Sum the cached contributions of the roads
+    const Combo_t& combo = combos[first+i];
+    NormalEq4 eq;
+    npoints[i] = AddRoadFitEqs( combo.roads, combo.roads+combo.n, eq, ywy[i] );
+    for( UInt_t k = 0; k < nA; ++k )
+      store[k*n+i] = eq.GetMatrix()[k];
+    for( UInt_t k = 0; k < nb; ++k )
+      store[(nA+k)*n+i] = eq.GetVector()[k];
+  }
+
+  SolveNormalEq4( n, a, b, x, &ok[0] );
+
+  for( UInt_t i = 0; i < n; ++i ) {
+    const Combo_t& combo = combos[first+i];
+    FitRes_t& fit = fits[first+i];
+    fit.matchval = combo.matchval;
+    fit.roads    = 0;
+    fit.chi2     = 0;
+    assert( npoints[i] > 4 );
+    if( npoints[i] <= 4 ) {
+      fit.ndof = -1;  // Meaningful fit not possible
+      continue;
+    }
+    assert( ok[i] );
+    if( !ok[i] ) {
+      fit.ndof = -2;  // Decomposition failed. Should never happen
+      continue;
+    }
+    Double_t xi[nb], bi[nb];
+    for( UInt_t k = 0; k < nb; ++k ) {
+      xi[k] = x[k][i];
+      bi[k] = b[k][i];
+    }
+    fit.coef.assign( xi, xi+nb );
+    fit.chi2 = FitChi2( ywy[i], bi, xi );
+    fit.ndof = npoints[i]-4;
+#ifdef VERBOSE
+    if( fDebug > 2 ) {
+      Rvec_t roads( combo.roads, combo.roads+combo.n );
+      cout << "Points in 3D fit:" << endl;
+      ForAllTrackPoints( roads, fit.coef, PrintFitPoint() );
+    }
+    if( fDebug > 1 )
+      cout << "3D fit:  x/y = " << fit.coef[0] << "/" << fit.coef[2] << " "
+	   << "mx/my = " << fit.coef[1] << "/" << fit.coef[3] << " "
+	   << "ndof = " << fit.ndof << " rchi2 = "
+	   << fit.chi2/(double)fit.ndof << endl;
+#endif
+  }
+}
+
 //_____________________________________________________________________________
 Int_t Tracker::NewTrackCalc( Int_t , THaTrack*, const TVector3&,
 			     const TVector3&, const FitRes_t& )
@@ -1176,173 +1270,510 @@ THaTrack* Tracker::NewTrack( TClonesArray& tracks, const FitRes_t& fit_par )
 }
 
 //_____________________________________________________________________________
-class CheckTypes : public unary_function<Road*,void>
+class TupleBits
 {
-  // Function object for testing the projection occupancy of roads.
-  // Applied to a road, it saves the road's plane type (u,v,x..).
-  // Testing the object returns true if all types specified in the 'req'
-  // argument to the constructor have been seen in all the roads tested.
+  // Bitset representation of the candidate road tuples for OptimalN.
+  // Sets of roads are bitsets over the indices of the unique roads of the
+  // event, nwords 64-bit words each. For each tuple, holds the set of its
+  // roads and the set of roads it blocks: its own roads and all roads
+  // sharing any hits with them, from a shared-hit conflict matrix
+  // precomputed once per event. Also holds the set of roads of each
+  // projection type.
 public:
-  explicit CheckTypes( UInt_t req ) : fReq(req), fActive(0) {}
-  void operator() ( const Road* rd )
-  { fActive |= 1U << rd->GetProjection()->GetType(); }
-  operator bool()       const { return (fActive & fReq) == fReq; }
-  bool     operator!()  const { return (fActive & fReq) != fReq; }
-  UInt_t   GetTypes()   const { return fActive; }
+  TupleBits( const Rvec_t& choices, const vec_uint_t& tuples, UInt_t width );
+
+  UInt_t GetNwords()  const { return fNwords; }
+  UInt_t GetNtuples() const { return fNtuples; }
+  const ULong64_t* Roads( UInt_t itup ) const
+  { return &fRoads[itup*fNwords]; }
+  const ULong64_t* Blocked( UInt_t itup ) const
+  { return &fBlocked[itup*fNwords]; }
+  const ULong64_t* TypeRoads( UInt_t type ) const
+  { return &fTypeRoads[type*fNwords]; }
+
+  static void SetBit( ULong64_t* bits, UInt_t i )
+  { bits[i/64] |= static_cast<ULong64_t>(1) << (i%64); }
+
 private:
-  UInt_t fReq;
-  UInt_t fActive;
+  UInt_t fNwords;
+  UInt_t fNtuples;
+  vector<ULong64_t> fRoads;      // [fNtuples*fNwords] Roads of each tuple
+  vector<ULong64_t> fBlocked;    // [fNtuples*fNwords] Roads blocked by tuple
+  vector<ULong64_t> fTypeRoads;  // [kTypeEnd*fNwords] Roads of each type
 };
 
 //_____________________________________________________________________________
-class AnySharedHits : public unary_function<Road*,bool>
+struct HitRoadIsLess
+  : public binary_function< pair<Hit*,UInt_t>, pair<Hit*,UInt_t>, bool >
 {
-public:
-  AnySharedHits() {}
-  bool operator() ( const Road* rd )
-  {
-    const Hset_t& test_hits = rd->GetHits();
-//     cout << "--- testing: " << endl;
-//     PrintHits(test_hits);
-    for( Hset_t::const_iterator it = test_hits.begin(); it != test_hits.end();
-	 ++it ) {
-      if( fHits.find(*it) != fHits.end() )
-	return true;
+  // Order (hit,road index) pairs by hit
+  bool operator() ( const pair<Hit*,UInt_t>& a,
+		    const pair<Hit*,UInt_t>& b ) const
+  { return Hit::PosIsLess()( a.first, b.first ); }
+};
+
+//_____________________________________________________________________________
+TupleBits::TupleBits( const Rvec_t& choices, const vec_uint_t& tuples,
+		      UInt_t width )
+  : fNwords((choices.size()+63)/64), fNtuples(tuples.size()/width)
+{
+  // Constructor. Arguments as for OptimalN.
+
+  UInt_t nchoices = choices.size();
+
+  // Shared-hit conflict matrix: for each road, the set of roads that have
+  // any hits in common with it, including the road itself. Hits are
+  // considered identical if they compare equal in the hit sets of the roads
+  vector<ULong64_t> conflicts( nchoices*fNwords, 0 );
+  fTypeRoads.assign( kTypeEnd*fNwords, 0 );
+  vector< pair<Hit*,UInt_t> > hits;
+  for( UInt_t i = 0; i < nchoices; ++i ) {
+    const Road* rd = choices[i];
+    SetBit( &conflicts[i*fNwords], i );
+    SetBit( &fTypeRoads[rd->GetProjection()->GetType()*fNwords], i );
+    const Hset_t& rdhits = rd->GetHits();
+    for( Hset_t::const_iterator it = rdhits.begin(); it != rdhits.end(); ++it )
+      hits.push_back( make_pair(*it,i) );
+  }
+  // Sort the (hit,road) pairs by hit, so that the roads sharing a hit
+  // are adjacent
+  Hit::PosIsLess hit_less;
+  sort( ALL(hits), HitRoadIsLess() );
+  for( UInt_t i = 0; i < hits.size(); ) {
+    UInt_t j = i+1;
+    while( j < hits.size() and !hit_less( hits[i].first, hits[j].first ) )
+      ++j;
+    for( UInt_t k = i; k < j; ++k ) {
+      for( UInt_t l = i; l < j; ++l )
+	SetBit( &conflicts[hits[k].second*fNwords], hits[l].second );
     }
-    return false;
-  }
-  const AnySharedHits& use( const Rset_t& tuple )
-  {
-    fHits.clear();
-    for( Rset_t::const_iterator it = tuple.begin(); it != tuple.end(); ++it ) {
-      const Road* rd = *it;
-      fHits.insert( ALL(rd->GetHits()) );
+    i = j;
+  }
+
+  // Road and blocked sets of the tuples
+  fRoads.assign( fNtuples*fNwords, 0 );
+  fBlocked.assign( fNtuples*fNwords, 0 );
+  for( UInt_t itup = 0; itup < fNtuples; ++itup ) {
+    ULong64_t* roads   = &fRoads[itup*fNwords];
+    ULong64_t* blocked = &fBlocked[itup*fNwords];
+    for( UInt_t j = 0; j < width; ++j ) {
+      UInt_t k = tuples[itup*width+j];
+      if( k != kMaxUInt ) {
+	assert( k < nchoices );
+	SetBit( roads, k );
+	const ULong64_t* conf = &conflicts[k*fNwords];
+	for( UInt_t w = 0; w < fNwords; ++w )
+	  blocked[w] |= conf[w];
+      }
     }
-//     PrintHits(fHits);
-    return *this;
   }
-private:
-  Hset_t fHits;
-};
+}
 
 //_____________________________________________________________________________
 class Tracker::TrackFitWeight
 {
   // Object for sorting fits. The smaller a track's TrackFitWeight, the
-  // "better" a track is considered to be.
+  // "better" a track is considered to be. Fits of equal ndof and chi2 keep
+  // the order of their tuple numbers.
 public:
-  explicit TrackFitWeight( const Tracker::FitRes_t& fit_par ) :
-    fNdof(fit_par.ndof), fChi2(fit_par.chi2) { assert(fNdof); }
+  TrackFitWeight( const Tracker::FitRes_t& fit_par, UInt_t itup ) :
+    fNdof(fit_par.ndof), fChi2(fit_par.chi2), fTuple(itup) { assert(fNdof); }
 
   bool operator<( const TrackFitWeight& rhs ) const
   {
     // The "best" tracks have the largest number of hits and the smallest chi2
     //TODO: devalue tracks with very large chi2?
-    return (fNdof != rhs.fNdof) ?
-      (fNdof > rhs.fNdof) : (fChi2 < rhs.fChi2);
+    if( fNdof != rhs.fNdof ) return ( fNdof > rhs.fNdof );
+    if( fChi2 != rhs.fChi2 ) return ( fChi2 < rhs.fChi2 );
+    return ( fTuple < rhs.fTuple );
   }
-  operator double() const { return fChi2/(double)fNdof; }
+  UInt_t GetTuple() const { return fTuple; }
 private:
   UInt_t   fNdof;
   Double_t fChi2;
+  UInt_t   fTuple;
 };
 
 //_____________________________________________________________________________
-template< typename Container, typename Weight, typename TestF,
-	  typename QuitF > Double_t
-OptimalN( const Container& choices, const multimap<Weight,Container>& weights,
-	  vector<Container>& picks, TestF testf, QuitF quitf )
+static void
+OptimalN( const TupleBits& tb, const vec_uint_t& order, UInt_t req_types,
+	  vec_uint_t& picks )
 {
   // This is the second-level de-ghosting algorithm, operating on fitted
   // 3D tracks.  It selects the best set of tracks if multiple roads
   // combinations are present in one or more projection.
   //
-  // Requirements:
-  //  "Container": STL container (set or sorted vector) supporting begin(),
-  //               insert(), end(), swap(), and containing "Element"s sorted
-  //               by Element's operator<.  Here, Element = Road*
-  //  "Weight":    sorting functor, supporting operator< and operator double()
-  //  "TestF":     Functor for eliminating additional leftover elements,
-  //               must support:
-  //                  operator() (const Element&): test this element,
-  //                                         eliminate if true
-  //                  use(const Container&): test against elements in this
-  //                                         container
-  //               (use() is in lieu of a constructor because the object
-  //                is constructed by the caller (possibly with parameters)).
-  //  "QuitF":     Functor for terminating search early. Applied to all
-  //               leftover elements. Must support
-  //                  operator() (const Element&)
-  //                  operator bool(): End search if false after running on
-  //                                   all elements
-
-  //TODO: how efficient? O(N^2)? (N iterations on include)
+  // Arguments:
+  //  tb:        bitsets of the candidate road tuples
+  //  order:     tuple numbers, sorted by ascending weight (see TrackFitWeight)
+  //  req_types: projection types that the roads of a track must cover.
+  //             The search ends when the leftover roads no longer do.
+  //  picks:     output, numbers of the selected tuples, in order of weight
+  //
+  // Greedy: in order of ascending weight, pick each tuple whose roads are all
+  // still available, then remove its roads and all roads sharing any hits
+  // with them from the available roads.
 
   picks.clear();
-  Container choices_left(choices);
-
-  //TODO: try minimizing chi2 sum
-  double wsum = 0;
-  typename multimap<Weight,Container>::const_iterator it = weights.begin();
-  for( ; it != weights.end(); ++it ) {
-    const Container& tuple = (*it).second;
-    if( includes(ALL(choices_left), ALL(tuple)) ) {
-      // Pick next set of still-available elements in order of ascending weight
-      picks.push_back( tuple );
-      // Sum of weights of chosen sets, converted to double
-      wsum += (*it).first;
-      // Remove chosen elements from the remaining choices
-      Container choices_less_tuple;
-      set_difference( ALL(choices_left), ALL(tuple),
-		      inserter(choices_less_tuple, choices_less_tuple.end()) );
-      // Test each remaining element against the chosen set of elements
-      // and remove it if it compares true (=remove elems with common traits)
-      Container new_choices_left;
-      remove_copy_if( ALL(choices_less_tuple),
-		      inserter(new_choices_left, new_choices_left.end()),
-		      testf.use(tuple) );
-      // Quit if the quit function, applied to each element still remaining
-      // now, is no longer true
-      if( !for_each(ALL(new_choices_left), quitf) )
-	break;
-      // Update the set of remaining elements
-      choices_left.swap( new_choices_left );
+  UInt_t nwords = tb.GetNwords();
+  // Bitset of the still-available roads
+  vector<ULong64_t> left( nwords, ~static_cast<ULong64_t>(0) );
+
+  for( vec_uint_t::const_iterator it = order.begin(); it != order.end(); ++it ) {
+    UInt_t itup = *it;
+    const ULong64_t* roads = tb.Roads(itup);
+    // Pick next set of still-available roads in order of ascending weight
+    bool available = true;
+    for( UInt_t w = 0; w < nwords and available; ++w ) {
+      if( roads[w] & ~left[w] )
+	available = false;
+    }
+    if( !available )
+      continue;
+    picks.push_back( itup );
+    // Remove chosen roads and all roads with common hits from the remaining
+    // choices
+    const ULong64_t* blocked = tb.Blocked(itup);
+    for( UInt_t w = 0; w < nwords; ++w )
+      left[w] &= ~blocked[w];
+    // Quit if the remaining roads no longer cover all required types
+    bool quit = false;
+    for( UInt_t type = 0; type < kTypeEnd and !quit; ++type ) {
+      if( (req_types & (1U << type)) == 0 )
+	continue;
+      const ULong64_t* type_roads = tb.TypeRoads(type);
+      bool found = false;
+      for( UInt_t w = 0; w < nwords and !found; ++w ) {
+	if( type_roads[w] & left[w] )
+	  found = true;
+      }
+      quit = !found;
+    }
+    if( quit )
+      break;
+  }
+}
+
+//_____________________________________________________________________________
+class ExactOptimalN
+{
+  // Exact version of OptimalN for a small number of candidate tuples (<= 64).
+  // Finds the set of mutually compatible tuples (no shared roads or hits)
+  // with the most tracks and, among those, the smallest sum of chi2s,
+  // subject to the same stopping rule as OptimalN: a set is not extended
+  // further once the roads still available no longer cover all required
+  // projection types. Solved by depth-first branch-and-bound, starting
+  // from the greedy solution, which is only replaced by a strictly better
+  // set. The search is abandoned after a maximum number of nodes, in which
+  // case the best solution found so far is returned.
+public:
+  ExactOptimalN( const TupleBits& tb, const vec_uint_t& order,
+		 const vector<Double_t>& chi2, UInt_t req_types,
+		 UInt_t maxnodes );
+
+  // Improve the solution in picks (initially the greedy solution).
+  // Returns false if the node limit was reached.
+  Bool_t Solve( vec_uint_t& picks );
+
+  UInt_t GetNnodes() const { return fNnodes; }
+
+  static const UInt_t kMaxTuples = 64;
+
+private:
+  void    Search( ULong64_t cand, ULong64_t chosen, UInt_t depth,
+		  Double_t chi2 );
+  Bool_t  Covered( const ULong64_t* left ) const;
+
+  const TupleBits&  fTuples;
+  const vec_uint_t& fOrder;
+  UInt_t    fNcand;       // Number of candidates (<= kMaxTuples)
+  UInt_t    fNwords;      // Words per road bitset
+  UInt_t    fReqTypes;    // Projection types the available roads must cover
+  vector<ULong64_t> fConflict; // [fNcand] Candidates conflicting with each
+  vector<Double_t>  fChi2;     // [fNcand] Chi2 of each candidate
+  vector<ULong64_t> fLeft;     // [(fNcand+1)*fNwords] Available roads/depth
+  UInt_t    fBestN;       // Number of tracks of the best solution
+  Double_t  fBestChi2;    // Sum of chi2s of the best solution
+  ULong64_t fBestSet;     // Candidates of the best solution
+  UInt_t    fNnodes;      // Number of search nodes visited
+  UInt_t    fMaxNodes;    // Maximum number of search nodes
+};
+
+//_____________________________________________________________________________
+ExactOptimalN::ExactOptimalN( const TupleBits& tb, const vec_uint_t& order,
+			      const vector<Double_t>& chi2, UInt_t req_types,
+			      UInt_t maxnodes )
+  : fTuples(tb), fOrder(order), fNcand(order.size()),
+    fNwords(tb.GetNwords()), fReqTypes(req_types), fConflict(fNcand,0),
+    fChi2(fNcand), fLeft((fNcand+1)*fNwords), fBestN(0), fBestChi2(0),
+    fBestSet(0), fNnodes(0), fMaxNodes(maxnodes)
+{
+  // Constructor. Candidates are numbered in order of ascending
+  // TrackFitWeight, i.e. in the given order of the tuples. chi2 is
+  // indexed by tuple number and must not be negative.
+
+  assert( fNcand <= kMaxTuples );
+  for( UInt_t i = 0; i < fNcand; ++i ) {
+    fChi2[i] = chi2[order[i]];
+    assert( fChi2[i] >= 0 );
+    // Tuples conflict if any roads of one are blocked by the other.
+    // This relation is symmetric.
+    const ULong64_t* blocked = tb.Blocked( order[i] );
+    for( UInt_t j = 0; j < i; ++j ) {
+      const ULong64_t* roads = tb.Roads( order[j] );
+      for( UInt_t w = 0; w < fNwords; ++w ) {
+	if( roads[w] & blocked[w] ) {
+	  fConflict[i] |= static_cast<ULong64_t>(1) << j;
+	  fConflict[j] |= static_cast<ULong64_t>(1) << i;
+	  break;
+	}
+      }
     }
+    fConflict[i] |= static_cast<ULong64_t>(1) << i;
   }
+}
 
-  return wsum;
+//_____________________________________________________________________________
+Bool_t ExactOptimalN::Covered( const ULong64_t* left ) const
+{
+  // True if the available roads in 'left' cover all required types
+
+  for( UInt_t type = 0; type < kTypeEnd; ++type ) {
+    if( (fReqTypes & (1U << type)) == 0 )
+      continue;
+    const ULong64_t* type_roads = fTuples.TypeRoads(type);
+    bool found = false;
+    for( UInt_t w = 0; w < fNwords and !found; ++w ) {
+      if( type_roads[w] & left[w] )
+	found = true;
+    }
+    if( !found )
+      return false;
+  }
+  return true;
+}
+
+//_____________________________________________________________________________
+Bool_t ExactOptimalN::Solve( vec_uint_t& picks )
+{
+  // Run the branch-and-bound search, using the tuples in picks as the
+  // initial solution, and return the best solution in picks, in order of
+  // weight.
+
+  fBestN = 0;
+  fBestChi2 = 0;
+  fBestSet = 0;
+  for( UInt_t i = 0; i < fNcand; ++i ) {
+    if( find( ALL(picks), fOrder[i] ) != picks.end() ) {
+      fBestSet |= static_cast<ULong64_t>(1) << i;
+      ++fBestN;
+      fBestChi2 += fChi2[i];
+    }
+  }
+  fNnodes = 0;
+  fill( fLeft.begin(), fLeft.begin()+fNwords, ~static_cast<ULong64_t>(0) );
+  ULong64_t all = ( fNcand < 64 ) ?
+    (static_cast<ULong64_t>(1) << fNcand) - 1 : ~static_cast<ULong64_t>(0);
+  Search( all, 0, 0, 0 );
+
+  picks.clear();
+  for( UInt_t i = 0; i < fNcand; ++i ) {
+    if( fBestSet & (static_cast<ULong64_t>(1) << i) )
+      picks.push_back( fOrder[i] );
+  }
+  return ( fNnodes <= fMaxNodes );
+}
+
+//_____________________________________________________________________________
+void ExactOptimalN::Search( ULong64_t cand, ULong64_t chosen, UInt_t depth,
+			    Double_t chi2 )
+{
+  // Extend the solution 'chosen', with sum of chi2s 'chi2', by the remaining
+  // compatible candidates 'cand'. 'depth' is the number of chosen
+  // candidates and indexes the available roads in fLeft.
+
+  if( ++fNnodes > fMaxNodes )
+    return;
+  // Like OptimalN, stop once the available roads no longer cover all
+  // required types, or when no compatible candidates are left
+  const ULong64_t* left = &fLeft[depth*fNwords];
+  if( cand == 0 or (depth > 0 and !Covered(left)) ) {
+    if( depth > fBestN or (depth == fBestN and chi2 < fBestChi2) ) {
+      fBestN = depth;
+      fBestChi2 = chi2;
+      fBestSet = chosen;
+    }
+    return;
+  }
+  // Bound: at most all remaining candidates can be added. If that only
+  // ties the number of tracks of the best solution, all of them must be
+  // added, so their chi2s must still lower the sum.
+  UInt_t nmax = depth;
+  Double_t chi2min = chi2;
+  for( UInt_t i = 0; i < fNcand; ++i ) {
+    if( cand & (static_cast<ULong64_t>(1) << i) ) {
+      ++nmax;
+      chi2min += fChi2[i];
+    }
+  }
+  if( nmax < fBestN or (nmax == fBestN and chi2min >= fBestChi2) )
+    return;
+  // Branch on the best remaining candidate: with it, then without it
+  UInt_t i = 0;
+  while( (cand & (static_cast<ULong64_t>(1) << i)) == 0 )
+    ++i;
+  ULong64_t bit = static_cast<ULong64_t>(1) << i;
+  const ULong64_t* blocked = fTuples.Blocked( fOrder[i] );
+  ULong64_t* next = &fLeft[(depth+1)*fNwords];
+  for( UInt_t w = 0; w < fNwords; ++w )
+    next[w] = left[w] & ~blocked[w];
+  Search( cand & ~fConflict[i], chosen | bit, depth+1, chi2 + fChi2[i] );
+  Search( cand & ~bit, chosen, depth, chi2 );
 }
 
 //_____________________________________________________________________________
 void Tracker::Add3dMatch( const Rvec_t& selected, Double_t matchval,
-			  list< pair<Double_t,Rvec_t> >& combos_found,
+			  Combos_t& combos_found,
+			  Rset_t& unique_found ) const
+{
+  // Save road combination with good matchvalue
+
+  assert( !selected.empty() );
+  Add3dMatch( Combo_t(matchval, &selected[0], selected.size()),
+	      combos_found, unique_found );
+}
+
+//_____________________________________________________________________________
+void Tracker::Add3dMatch( const Combo_t& combo, Combos_t& combos_found,
 			  Rset_t& unique_found ) const
 {
   // Save road combination with good matchvalue
 
-  combos_found.push_back( make_pair(matchval,selected) );
+  combos_found.push_back( combo );
 
   // Since not all of the roads in 'roads' may make a match,
   // keep track of unique roads found for each projection type
 
-  unique_found.insert( ALL(selected) );
+  unique_found.insert( combo.roads, combo.roads+combo.n );
 
 #ifdef VERBOSE
   if( fDebug > 3 )
     cout << "ACCEPTED" << endl;
 #endif
-};
+}
 
 //_____________________________________________________________________________
-UInt_t Tracker::MatchRoadsGeneric( vector<Rvec_t>& roads, const UInt_t ncombos,
-				   list< pair<Double_t,Rvec_t> >& combos_found,
-				   Rset_t& unique_found )
+Double_t Tracker::MatchValue( const Rvec_t& selected ) const
 {
-  // General MatchRoad algorithm:
+  // Compute the 3D matchval of the given road combination, one road from
+  // each projection:
   //  - find all front and back intersections [ n(n-1)/2 each ]
   //  - compute weighted center of gravity of intersection points
   //  - sum dist^2 of points to center of gravity -> matchval
-  // Requires at least 3 projections
+  // Returns kBig if either center of gravity lies outside of the active
+  // area of the front or back plane.
+
+  Rvec_t::size_type nproj = selected.size();
+  assert( nproj >= 2 );
+
+  // Front/back positions of the selected roads
+  Double_t fpos[kTypeEnd], bpos[kTypeEnd];
+  assert( nproj <= (Rvec_t::size_type)kTypeEnd );
+  for( Rvec_t::size_type k = 0; k < nproj; ++k ) {
+    fpos[k] = selected[k]->GetPos(fFrontZ);
+    bpos[k] = selected[k]->GetPos(fBackZ);
+  }
+  TVector2 fxpts[kTypeEnd*(kTypeEnd-1)/2], bxpts[kTypeEnd*(kTypeEnd-1)/2];
+  UInt_t npts = 0;
+  TVector2 fctr, bctr;
+  for( Rvec_t::size_type k1 = 0; k1 < nproj; ++k1 ) {
+    EProjType t1 = selected[k1]->GetProjection()->GetType();
+    for( Rvec_t::size_type k2 = k1+1; k2 < nproj; ++k2 ) {
+      const ProjPair_t& pp =
+	GetProjPair( t1, selected[k2]->GetProjection()->GetType() );
+      //TODO: weigh with uncertainties of coordinates?
+      fxpts[npts].Set( pp.X(fpos[k1],fpos[k2]), pp.Y(fpos[k1],fpos[k2]) );
+      bxpts[npts].Set( pp.X(bpos[k1],bpos[k2]), pp.Y(bpos[k1],bpos[k2]) );
+      fctr += fxpts[npts];
+      bctr += bxpts[npts];
+#ifdef VERBOSE
+      Road *rd1 = selected[k1], *rd2 = selected[k2];
+      if( fDebug > 3 ) {
+	cout << rd1->GetProjection()->GetName()
+	     << rd2->GetProjection()->GetName()
+	     << " front(" << npts+1 << ") = ";
+	fxpts[npts].Print();
+	cout << rd1->GetProjection()->GetName()
+	     << rd2->GetProjection()->GetName()
+	     << " back (" << npts+1 << ") = ";
+	bxpts[npts].Print();
+      }
+#endif
+      ++npts;
+    }
+  }
+  assert( npts == nproj*(nproj-1)/2 );
+  fctr /= static_cast<Double_t>( npts );
+  if( !fFrontBox.Contains(fctr.X(),fctr.Y()) )
+    return kBig;
+  bctr /= static_cast<Double_t>( npts );
+  if( !fBackBox.Contains(bctr.X(),bctr.Y()) )
+    return kBig;
+  Double_t matchval = 0.0;
+  for( UInt_t k = 0; k < npts; ++k ) {
+    matchval += (fxpts[k]-fctr).Mod2() + (bxpts[k]-bctr).Mod2();
+  }
+#ifdef VERBOSE
+  if( fDebug > 3 ) {
+    cout << "fctr = "; fctr.Print();
+    cout << "bctr = "; bctr.Print();
+    cout << "matchval = " << matchval << endl;
+  }
+#endif
+  // We could just connect fctr and bctr here to get an approximate
+  // 3D track. But the linear minimization in FitTrack is the right
+  // way to do this.
+
+  return matchval;
+}
+
+//_____________________________________________________________________________
+// Running sums of the front and back intersection points of a partial road
+// combination. Their spread about their centers of gravity is a lower bound
+// for the matchval of any complete combination containing them.
+struct MatchSums {
+  Double_t fx, fy, f2, bx, by, b2;
+  UInt_t   n;
+  MatchSums() : fx(0), fy(0), f2(0), bx(0), by(0), b2(0), n(0) {}
+  void Add( Double_t xf, Double_t yf, Double_t xb, Double_t yb ) {
+    fx += xf; fy += yf; f2 += xf*xf + yf*yf;
+    bx += xb; by += yb; b2 += xb*xb + yb*yb;
+    ++n;
+  }
+  Double_t Matchval() const {
+    if( n < 2 ) return 0;
+    return f2 - (fx*fx + fy*fy)/n + b2 - (bx*bx + by*by)/n;
+  }
+};
+
+//_____________________________________________________________________________
+// Sort road vectors by ascending size
+struct BySize : public binary_function< Rvec_t*, Rvec_t*, bool >
+{
+  bool operator() ( const Rvec_t* a, const Rvec_t* b ) const
+  { return ( a->size() < b->size() ); }
+};
+
+//_____________________________________________________________________________
+UInt_t Tracker::MatchRoadsGeneric( vector<Rvec_t>& roads,
+				   const UInt_t /* ncombos */,
+				   Combos_t& combos_found,
+				   Rset_t& unique_found )
+{
+  // General MatchRoad algorithm for any number n >= 3 of projections.
+  // The matchval of each combination is computed by MatchValue().
+  // The two projections with the fewest roads are used as the seed pair
+  // (see MatchRoadsSeeded).
 
   vector<Rvec_t>::size_type nproj = roads.size();
   assert( nproj >= 3 );
@@ -1352,80 +1783,282 @@ UInt_t Tracker::MatchRoadsGeneric( vector<Rvec_t>& roads, const UInt_t ncombos,
     cout << "generic algo):";
 #endif
 
-  // Vector holding a combination of roads to test. One road from each
-  // projection
-  Rvec_t selected;
+  // Processing order of the projections: ascending number of roads
+  vector<Rvec_t*> proj_roads( nproj );
+  for( vector<Rvec_t>::size_type k = 0; k < nproj; ++k ) {
+    assert( !roads[k].empty() );
+    proj_roads[k] = &roads[k];
+  }
+  sort( ALL(proj_roads), BySize() );
 
-  UInt_t nfound = 0;
-  Double_t zback = fPlanes.back()->GetZ();
-
-  vector<TVector2> fxpts, bxpts;
-  fxpts.reserve( nproj*(nproj-1)/2 );
-  bxpts.reserve( nproj*(nproj-1)/2 );
-
-  for( UInt_t i = 0; i < ncombos; ++i ) {
-    Double_t matchval = 0.0;
-
-    NthCombination( i, roads, selected );
-    assert( selected.size() == nproj );
-
-    fxpts.clear();
-    bxpts.clear();
-    TVector2 fctr, bctr;
-    for( Rvec_t::iterator it1 = selected.begin(); it1 != selected.end();
-	 ++it1 ) {
-      for( Rvec_t::iterator it2 = it1+1; it2 != selected.end(); ++it2 ) {
-	//TODO: weigh with uncertainties of coordinates?
-	fxpts.push_back( (*it1)->Intersect(*it2, 0.0) );
-	bxpts.push_back( (*it1)->Intersect(*it2, zback) );
-	fctr += fxpts.back();
-	bctr += bxpts.back();
-#ifdef VERBOSE
-	Road *rd1 = *it1, *rd2 = *it2;
-	if( fDebug > 3 ) {
-	  cout << rd1->GetProjection()->GetName()
-	       << rd2->GetProjection()->GetName()
-	       << " front(" << fxpts.size() << ") = ";
-	  fxpts.back().Print();
-	  cout << rd1->GetProjection()->GetName()
-	       << rd2->GetProjection()->GetName()
-	       << " back (" << bxpts.size() << ") = ";
-	  bxpts.back().Print();
-	}
-#endif
+  return MatchRoadsSeeded( roads, proj_roads, combos_found, unique_found );
+}
+
+//_____________________________________________________________________________
+UInt_t Tracker::MatchRoadsFastN( vector<Rvec_t>& roads, UInt_t ncombos,
+				 Combos_t& combos_found,
+				 Rset_t& unique_found )
+{
+  // Fast MatchRoad algorithm for four or more projections. Same as the
+  // generic algorithm, except that the seed pair is the best-conditioned
+  // pair of projections (closest to perpendicular), determined in Init.
+  // Its intersection points are the most precise, so the search windows
+  // in the other projections are the narrowest. Falls back to the generic
+  // algorithm if one of the seed projections has no roads.
+
+  vector<Rvec_t>::size_type nproj = roads.size();
+  assert( nproj >= 3 );
+  assert( f3dSeed.size() == 2 );
+
+  vector<Rvec_t*> proj_roads;
+  proj_roads.reserve( nproj );
+  for( UInt_t i = 0; i < 2; ++i ) {
+    for( vector<Rvec_t>::size_type k = 0; k < nproj; ++k ) {
+      assert( !roads[k].empty() );
+      EProjType type = roads[k].front()->GetProjection()->GetType();
+      if( (UInt_t)type == f3dSeed[i] ) {
+	proj_roads.push_back( &roads[k] );
+	break;
       }
     }
-    assert( fxpts.size() <= nproj*(nproj-1)/2 );
-    assert( bxpts.size() == fxpts.size() );
-    fctr /= static_cast<Double_t>( fxpts.size() );
-    if( !fPlanes.front()->Contains(fctr) )
-      continue;
-    bctr /= static_cast<Double_t>( fxpts.size() );
-    if( !fPlanes.back()->Contains(bctr) )
-      continue;
-    for( vector<TVector2>::size_type k = 0; k < fxpts.size(); ++k ) {
-      matchval += (fxpts[k]-fctr).Mod2() + (bxpts[k]-bctr).Mod2();
-    }
+  }
+  if( proj_roads.size() != 2 )
+    return MatchRoadsGeneric( roads, ncombos, combos_found, unique_found );
+
 #ifdef VERBOSE
-    if( fDebug > 3 ) {
-      cout << "fctr = "; fctr.Print();
-      cout << "bctr = "; bctr.Print();
-      cout << "matchval = " << matchval << endl;
-    }
+  if( fDebug > 0 )
+    cout << "fast N algo):";
 #endif
-    // We could just connect fctr and bctr here to get an approximate
-    // 3D track. But the linear minimization in FitTrack is the right
-    // way to do this.
 
-    if( matchval < f3dMatchCut ) {
-      ++nfound;
-      Add3dMatch( selected, matchval, combos_found, unique_found );
+  // The remaining projections follow in order of ascending number of roads
+  for( vector<Rvec_t>::size_type k = 0; k < nproj; ++k ) {
+    if( &roads[k] != proj_roads[0] and &roads[k] != proj_roads[1] )
+      proj_roads.push_back( &roads[k] );
+  }
+  assert( proj_roads.size() == nproj );
+  sort( proj_roads.begin()+2, proj_roads.end(), BySize() );
+
+  return MatchRoadsSeeded( roads, proj_roads, combos_found, unique_found );
+}
+
+//_____________________________________________________________________________
+// Work item for parallel 3D matching: one road of the first (seed or u)
+// projection, combined with all roads of the other projections
+class Tracker::MatchRowTask : public TaskPool::Task {
+public:
+  MatchRowTask( const Tracker* tracker, vector<Combos_t>& rows,
+		const vector<Rvec_t>* roads, const SeedSetup_t* setup )
+    : fTracker(tracker), fRows(rows), fRoads(roads), fSetup(setup) {}
+  virtual void Run( UInt_t i )
+  {
+    if( fSetup )
+      fTracker->MatchSeededRow( *fSetup, i, fRows[i] );
+    else
+      fTracker->MatchFast3DRow( *fRoads, i, fRows[i] );
+  }
+private:
+  const Tracker*      fTracker;
+  vector<Combos_t>&  fRows;    // Output buffer for each row
+  const vector<Rvec_t>* fRoads; // Input roads for MatchRoadsFast3D
+  const SeedSetup_t*  fSetup;   // Input setup for MatchRoadsSeeded
+};
+
+//_____________________________________________________________________________
+Bool_t Tracker::UseMatchPool( UInt_t nrows, UInt_t ncols ) const
+{
+  // Return true if the 3D matching of nrows x ncols seed pairs should be
+  // spread over the worker pool
+
+  return ( fPool and nrows > 1 and
+	   static_cast<Double_t>(nrows)*ncols >= f3dMinParallelPairs );
+}
+
+//_____________________________________________________________________________
+UInt_t Tracker::MatchRows( vector<Combos_t>& rows, const vector<Rvec_t>* roads,
+			   const SeedSetup_t* setup,
+			   Combos_t& combos_found,
+			   Rset_t& unique_found )
+{
+  // Match all rows in parallel, each into its own buffer, then merge the
+  // results in row order so that the output is the same as when running
+  // single-threaded.
+
+  assert( fPool );
+  MatchRowTask task( this, rows, roads, setup );
+  fPool->Process( &task, rows.size() );
+
+  UInt_t nfound = 0;
+  for( vector<Combos_t>::iterator it = rows.begin(); it != rows.end(); ++it )
+    nfound += Save3dMatches( *it, combos_found, unique_found );
+  return nfound;
+}
+
+//_____________________________________________________________________________
+UInt_t Tracker::Save3dMatches( const Combos_t& matches,
+			       Combos_t& combos_found,
+			       Rset_t& unique_found ) const
+{
+  // Save the given road combinations via Add3dMatch. Returns their number.
+
+  for( Combos_t::const_iterator it = matches.begin();
+       it != matches.end(); ++it )
+    Add3dMatch( *it, combos_found, unique_found );
+  return matches.size();
+}
+
+//_____________________________________________________________________________
+UInt_t Tracker::MatchRoadsSeeded( vector<Rvec_t>& roads,
+				  const vector<Rvec_t*>& proj_roads,
+				  Combos_t& combos_found,
+				  Rset_t& unique_found )
+{
+  // Find all combinations of roads with matchval < f3dMatchCut.
+  // proj_roads points to the elements of 'roads' in processing order.
+  //
+  // Instead of enumerating all combinations of roads, build them up one
+  // projection at a time:
+  //  - intersect all roads of the first two projections (the seed pairs)
+  //  - for each further projection, query its roads, sorted by front
+  //    position, for positions near the seed intersection point. Any road
+  //    farther away than sqrt(2*cut)*|sin(angle to seed projections)|
+  //    cannot make a match
+  //  - drop partial combinations once the spread of their intersection
+  //    points alone exceeds the matchval cut
+  // The cost is then roughly proportional to the number of matches rather
+  // than the product of the numbers of roads.
+  // With many seed pairs, the roads of the first projection are processed
+  // in parallel by the worker pool.
+
+  vector<Rvec_t>::size_type nproj = roads.size();
+  assert( nproj >= 3 and proj_roads.size() == nproj );
+
+  typedef vector<Rvec_t>::size_type prsiz_t;
+  SeedSetup_t setup;
+  setup.proj_roads = proj_roads;
+  // Index of each projection's roads in the output combination (same
+  // order as the input, as with the original enumeration)
+  setup.outidx.resize( nproj );
+  setup.type.resize( nproj );
+  setup.axx.resize( nproj );
+  setup.axy.resize( nproj );
+  setup.window.assign( nproj, 0.0 );
+  const Double_t maxdist = TMath::Sqrt( 2.0*f3dMatchCut );
+  const TVector2& a0 = proj_roads[0]->front()->GetProjection()->GetAxis();
+  const TVector2& a1 = proj_roads[1]->front()->GetProjection()->GetAxis();
+  for( prsiz_t d = 0; d < nproj; ++d ) {
+    setup.outidx[d] = proj_roads[d] - &roads[0];
+    const Projection* proj = proj_roads[d]->front()->GetProjection();
+    const TVector2& axis = proj->GetAxis();
+    setup.type[d] = proj->GetType();
+    setup.axx[d] = axis.X();
+    setup.axy[d] = axis.Y();
+    if( d >= 2 ) {
+      // Sort by ascending front position for range queries
+      sort( ALL(*proj_roads[d]), Road::PosIsLess() );
+      Double_t s0 = TMath::Abs( axis^a0 ), s1 = TMath::Abs( axis^a1 );
+      setup.window[d] = maxdist * TMath::Min( s0, s1 );
     }
-  } //for(ncombos)
+  }
 
+  UInt_t nrows = proj_roads[0]->size();
+  vector<Combos_t> rows;
+  if( UseMatchPool(nrows, proj_roads[1]->size()) ) {
+    rows.resize( nrows );
+    return MatchRows( rows, 0, &setup, combos_found, unique_found );
+  }
+
+  UInt_t nfound = 0;
+  rows.resize( 1 );
+  for( UInt_t i = 0; i < nrows; ++i ) {
+    rows[0].clear();
+    MatchSeededRow( setup, i, rows[0] );
+    nfound += Save3dMatches( rows[0], combos_found, unique_found );
+  }
   return nfound;
 }
 
+//_____________________________________________________________________________
+void Tracker::MatchSeededRow( const SeedSetup_t& setup, UInt_t irow,
+			      Combos_t& matches ) const
+{
+  // Find all good road combinations of MatchRoadsSeeded that contain road
+  // 'irow' of the first seed projection. Results are appended to 'matches'.
+  // Safe to call concurrently for different rows.
+
+  const vector<Rvec_t*>& proj_roads = setup.proj_roads;
+  typedef vector<Rvec_t>::size_type prsiz_t;
+  prsiz_t nproj = proj_roads.size();
+  assert( irow < proj_roads[0]->size() );
+
+  Rvec_t selected( nproj, 0 );
+  Rvec_t chosen( nproj, 0 );
+  vector<Double_t> fpos( nproj ), bpos( nproj );
+  vector<MatchSums> sums( nproj+1 );
+  typedef Rvec_t::iterator riter_t;
+  typedef Rvec_t::const_iterator rciter_t;
+  vector<riter_t> cur( nproj ), last( nproj );
+
+  const Rvec_t& seed1 = *proj_roads[1];
+  const ProjPair_t& pp01 = GetProjPair( setup.type[0], setup.type[1] );
+  chosen[0] = (*proj_roads[0])[irow];
+  fpos[0] = chosen[0]->GetPos(fFrontZ);
+  bpos[0] = chosen[0]->GetPos(fBackZ);
+  for( rciter_t it1 = seed1.begin(); it1 != seed1.end(); ++it1 ) {
+    chosen[1] = *it1;
+    fpos[1] = chosen[1]->GetPos(fFrontZ);
+    bpos[1] = chosen[1]->GetPos(fBackZ);
+    Double_t xf = pp01.X(fpos[0],fpos[1]), yf = pp01.Y(fpos[0],fpos[1]);
+    sums[2] = MatchSums();
+    sums[2].Add( xf, yf,
+		 pp01.X(bpos[0],bpos[1]), pp01.Y(bpos[0],bpos[1]) );
+
+    // Depth-first search over the remaining projections
+    prsiz_t d = 2;
+    bool enter = true;
+    while( d >= 2 ) {
+      if( enter ) {
+	// Find the roads near the position predicted by the seed pair
+	Double_t pred = xf*setup.axx[d] + yf*setup.axy[d];
+	pair<riter_t,riter_t> range =
+	  equal_range( ALL(*proj_roads[d]), pred,
+		       Road::PosIsNear(setup.window[d]) );
+	cur[d]  = range.first;
+	last[d] = range.second;
+	enter = false;
+      }
+      if( cur[d] == last[d] ) {
+	--d;
+	continue;
+      }
+      Road* rd = *cur[d]++;
+      chosen[d] = rd;
+      fpos[d] = rd->GetPos(fFrontZ);
+      bpos[d] = rd->GetPos(fBackZ);
+      MatchSums& s = sums[d+1];
+      s = sums[d];
+      for( prsiz_t j = 0; j < d; ++j ) {
+	const ProjPair_t& pp = GetProjPair( setup.type[j], setup.type[d] );
+	s.Add( pp.X(fpos[j],fpos[d]), pp.Y(fpos[j],fpos[d]),
+	       pp.X(bpos[j],bpos[d]), pp.Y(bpos[j],bpos[d]) );
+      }
+      if( s.Matchval() >= f3dMatchCut )
+	continue;  // No complete combination can match
+      if( d+1 < nproj ) {
+	++d;
+	enter = true;
+	continue;
+      }
+
+      // Complete combination. Calculate its actual matchval
+      for( prsiz_t k = 0; k < nproj; ++k )
+	selected[setup.outidx[k]] = chosen[k];
+      Double_t matchval = MatchValue( selected );
+      if( matchval < f3dMatchCut )
+	matches.push_back( Combo_t(matchval, &selected[0], nproj) );
+    }
+  }
+}
+
 //_____________________________________________________________________________
 // Functor for sorting a vector< vector<Road*> > according to the order
 // of projections types defined by the supplied lookup table.
@@ -1453,7 +2086,7 @@ private:
 
 //_____________________________________________________________________________
 UInt_t Tracker::MatchRoadsFast3D( vector<Rvec_t>& roads, UInt_t /* ncombos */,
-				  list< pair<Double_t,Rvec_t> >& combos_found,
+				  Combos_t& combos_found,
 				  Rset_t& unique_found )
 {
   // Fast MatchRoad algorithm for the special case n==3 and symmetric angles
@@ -1463,6 +2096,8 @@ UInt_t Tracker::MatchRoadsFast3D( vector<Rvec_t>& roads, UInt_t /* ncombos */,
   // Requires exactly 3 projections
   // Note that the elements of the Rvec_t in the output 'combos_found' are not
   // necessarily in order of ascending projection type.
+  // With many u/v pairs, the u-roads are processed in parallel by the
+  // worker pool.
 
   vector<Rvec_t>::size_type nproj = roads.size();
   assert( (nproj == 3) and (fProj.size() == nproj) );
@@ -1474,10 +2109,6 @@ UInt_t Tracker::MatchRoadsFast3D( vector<Rvec_t>& roads, UInt_t /* ncombos */,
     cout << "fast algo):";
 #endif
 
-  // Vector holding a combination of roads to test. One road from each
-  // projection
-  Rvec_t selected( nproj, 0 );
-
   // Put the road lists in the order of the projection symmetry axes.
   // After sorting, roads[0] and roads[1] correspond to the two projections
   // with symmetric angles around the symmetry axis, represented by roads[2].
@@ -1486,144 +2117,203 @@ UInt_t Tracker::MatchRoadsFast3D( vector<Rvec_t>& roads, UInt_t /* ncombos */,
   if( !f3dIdx.empty() )
     sort( ALL(roads), ByProjTypeMap(f3dIdx) );
 
-  // Fetch coefficients for coordinate transformations
+  // For fast access to the relevant position range, sort the 3rd projection
+  // by ascending front position
+  sort( ALL(roads[2]), Road::PosIsLess() );
+
+  UInt_t nrd0 = roads[0].size();
+  vector<Combos_t> rows;
+  if( UseMatchPool(nrd0, roads[1].size()) ) {
+    rows.resize( nrd0 );
+    return MatchRows( rows, &roads, 0, combos_found, unique_found );
+  }
+
+  UInt_t nfound = 0;
+  rows.resize( 1 );
+  for( UInt_t ird0 = 0; ird0 < nrd0; ++ird0 ) {
+    rows[0].clear();
+    MatchFast3DRow( roads, ird0, rows[0] );
+    nfound += Save3dMatches( rows[0], combos_found, unique_found );
+  }
+  return nfound;
+}
+
+//_____________________________________________________________________________
+void Tracker::MatchFast3DRow( const vector<Rvec_t>& roads, UInt_t ird0,
+			      Combos_t& matches ) const
+{
+  // Find all good road combinations of MatchRoadsFast3D that contain u-road
+  // 'ird0'. 'roads' must be prepared by MatchRoadsFast3D. Results are
+  // appended to 'matches'. Safe to call concurrently for different ird0.
+
+  // Fetch precomputed coefficients for the u/v intersection
   const Projection* ip = roads[0].front()->GetProjection();
-  Double_t su = ip->GetSinAngle();
-  Double_t cu = ip->GetCosAngle();
   assert( ip != roads[1].front()->GetProjection() );
-  ip = roads[1].front()->GetProjection();
-  Double_t sv = ip->GetSinAngle();
-  Double_t cv = ip->GetCosAngle();
-  Double_t inv_denom = 1.0/(sv*cu-su*cv);
-  // Only the scaled coefficients are needed (cf. Road::Intersect)
-  su *= inv_denom; cu *= inv_denom; sv *= inv_denom; cv *= inv_denom;
-  assert( ip != roads[2].front()->GetProjection() );
+  const ProjPair_t& pp =
+    GetProjPair( ip->GetType(), roads[1].front()->GetProjection()->GetType() );
   ip = roads[2].front()->GetProjection();
-  assert( ip != roads[0].front()->GetProjection() );
+  assert( ip != roads[0].front()->GetProjection() and
+	  ip != roads[1].front()->GetProjection() );
   // Components of the 3rd projection's axis
   Double_t xax_x = ip->GetAxis().X();
   Double_t xax_y = ip->GetAxis().Y();
 
   // The selected roads from each of the three projections
   Road* tuple[3];
-  Plane *front_plane = fPlanes.front(), *back_plane = fPlanes.back();
 
-  // For fast access to the relevant position range, sort the 3rd projection
-  // by ascending front position
-  sort( ALL(roads[2]), Road::PosIsLess() );
   Road::PosIsNear pos_near( TMath::Sqrt(f3dMatchCut) );
 
-  UInt_t nfound = 0;
-  Double_t zback = fPlanes.back()->GetZ();
+  Double_t zback = fBackZ;
   Double_t matchval = 0.0;
-  // Number of roads in u/v projections
-  UInt_t nrd0 = roads[0].size(), nrd1 = roads[1].size();
-  // ird0 and ird1 (below) are the indices of the currently selected u/v pair
-  UInt_t ird0 = 0;
+  // Number of roads in v projection
+  UInt_t nrd1 = roads[1].size();
+  assert( ird0 < roads[0].size() );
   // Time-critical loop, may run O(1e5) times per event with noisy input
-  while( ird0 != nrd0 ) {
-    tuple[0] = roads[0][ird0];
-    Double_t uf = tuple[0]->GetPos();
-    Double_t ub = tuple[0]->GetPos(zback);
-    Double_t usf = uf * sv;
-    Double_t ucf = uf * cv;
-    Double_t usb = ub * sv;
-    Double_t ucb = ub * cv;
-    UInt_t ird1 = 0;
-    while( ird1 != nrd1 ) {
-      tuple[1] = roads[1][ird1];
-      Double_t v = tuple[1]->GetPos();
-      Double_t xf = usf - v * su;
-      Double_t yf = v * cu - ucf;
-      if( front_plane->Contains(xf,yf) ) {
-	v = tuple[1]->GetPos(zback);
-	Double_t xb = usb - v * su;
-	Double_t yb = v * cu - ucb;
-	if( back_plane->Contains(xb,yb) ) {
-	  Double_t pf = xf*xax_x + yf*xax_y; // front x from u/v
-	  Double_t pb = xb*xax_x + yb*xax_y; // back x from u/v
-	  // Find range of roads in 3rd projection near this front x
-	  pair<Rvec_t::iterator,Rvec_t::iterator> range =
-	    equal_range( ALL(roads[2]), pf, pos_near );
-	  // Test the candidate x-roads for complete matches
-	  for( Rvec_t::iterator it=range.first; it != range.second; ++it ) {
-	    tuple[2] = *it;
-	    Double_t d1 = tuple[2]->GetPos()      - pf;
-	    Double_t d2 = tuple[2]->GetPos(zback) - pb;
-	    //TODO; weigh with uncertainties?
-	    matchval = d1*d1 + d2*d2;
+  tuple[0] = roads[0][ird0];
+  Double_t uf = tuple[0]->GetPos(fFrontZ);
+  Double_t ub = tuple[0]->GetPos(zback);
+  Double_t uxf = uf * pp.cxu;
+  Double_t uyf = uf * pp.cyu;
+  Double_t uxb = ub * pp.cxu;
+  Double_t uyb = ub * pp.cyu;
+  // ird1 is the index of the currently selected v-road
+  UInt_t ird1 = 0;
+  while( ird1 != nrd1 ) {
+    tuple[1] = roads[1][ird1];
+    Double_t v = tuple[1]->GetPos(fFrontZ);
+    Double_t xf = uxf + v * pp.cxv;
+    Double_t yf = uyf + v * pp.cyv;
+    if( fFrontBox.Contains(xf,yf) ) {
+      v = tuple[1]->GetPos(zback);
+      Double_t xb = uxb + v * pp.cxv;
+      Double_t yb = uyb + v * pp.cyv;
+      if( fBackBox.Contains(xb,yb) ) {
+	Double_t pf = xf*xax_x + yf*xax_y; // front x from u/v
+	Double_t pb = xb*xax_x + yb*xax_y; // back x from u/v
+	// Find range of roads in 3rd projection near this front x
+	pair<Rvec_t::const_iterator,Rvec_t::const_iterator> range =
+	  equal_range( ALL(roads[2]), pf, pos_near );
+	// Test the candidate x-roads for complete matches
+	for( Rvec_t::const_iterator it=range.first; it != range.second; ++it ) {
+	  tuple[2] = *it;
+	  Double_t d1 = tuple[2]->GetPos(fFrontZ) - pf;
+	  Double_t d2 = tuple[2]->GetPos(zback) - pb;
+	  //TODO; weigh with uncertainties?
+	  matchval = d1*d1 + d2*d2;
 #ifdef VERBOSE
-	    if( fDebug > 3 ) {
-	      if( matchval < f3dMatchCut || fDebug > 4 ) {
-		cout << tuple[0]->GetProjection()->GetName()
-		     << tuple[1]->GetProjection()->GetName()
-		     << " front = " << "(" << xf << "," << yf << ")" << endl;
-		cout << "front " << tuple[2]->GetProjection()->GetName()
-		     << " = ("
-		     << tuple[2]->GetPos() * xax_x << ","
-		     << tuple[2]->GetPos() * xax_y << ")" << endl;
-		cout << "front dist = " << d1 << endl;
-		cout << tuple[0]->GetProjection()->GetName()
-		     << tuple[1]->GetProjection()->GetName()
-		     << " back = " << "(" << xb << "," << yb << ")" << endl;
-		cout << "back " << tuple[2]->GetProjection()->GetName()
-		     << " =  ("
-		     << tuple[2]->GetPos(zback) * xax_x << ","
-		     << tuple[2]->GetPos(zback) * xax_y << ")" << endl;
-		cout << "back dist = " << d2 << endl;
-		cout << "matchval = " << matchval*f3dMatchvalScalefact
-		     << endl;
-	      }
-	    }
-#endif
-	    // Check if match, if so then add
-	    if( matchval < f3dMatchCut ) {
-	      ++nfound;
-	      selected.assign( tuple, tuple+3 );
-	      Add3dMatch( selected, matchval, combos_found, unique_found );
+	  if( fDebug > 3 ) {
+	    if( matchval < f3dMatchCut || fDebug > 4 ) {
+	      cout << tuple[0]->GetProjection()->GetName()
+		   << tuple[1]->GetProjection()->GetName()
+		   << " front = " << "(" << xf << "," << yf << ")" << endl;
+	      cout << "front " << tuple[2]->GetProjection()->GetName()
+		   << " = ("
+		   << tuple[2]->GetPos() * xax_x << ","
+		   << tuple[2]->GetPos() * xax_y << ")" << endl;
+	      cout << "front dist = " << d1 << endl;
+	      cout << tuple[0]->GetProjection()->GetName()
+		   << tuple[1]->GetProjection()->GetName()
+		   << " back = " << "(" << xb << "," << yb << ")" << endl;
+	      cout << "back " << tuple[2]->GetProjection()->GetName()
+		   << " =  ("
+		   << tuple[2]->GetPos(zback) * xax_x << ","
+		   << tuple[2]->GetPos(zback) * xax_y << ")" << endl;
+	      cout << "back dist = " << d2 << endl;
+	      cout << "matchval = " << matchval*f3dMatchvalScalefact
+		   << endl;
 	    }
 	  }
+#endif
+	  // Check if match, if so then keep it
+	  if( matchval < f3dMatchCut )
+	    matches.push_back( Combo_t(matchval, tuple, 3) );
 	}
       }
-      ++ird1;
     }
-    ++ird0;
+    ++ird1;
   }
+}
 
-  return nfound;
-};
+//_____________________________________________________________________________
+static ULong64_t CountCombos( const vector<Rvec_t>& roads )
+{
+  // Number of all possible combinations of the given roads, i.e. the
+  // product of the numbers of roads in each (non-empty) projection.
+  // Saturates at the largest ULong64_t instead of overflowing.
+
+  const ULong64_t kMaxCombos = ~static_cast<ULong64_t>(0);
+  ULong64_t ncombos = 1;
+  for( vector<Rvec_t>::const_iterator it = roads.begin();
+       it != roads.end(); ++it ) {
+    ULong64_t n = it->size();
+    if( n == 0 )
+      continue;
+    if( ncombos > kMaxCombos / n )
+      return kMaxCombos;
+    ncombos *= n;
+  }
+  return ncombos;
+}
+
+//_____________________________________________________________________________
+static void KeepBestRoads( vector<Rvec_t>& roads, UInt_t nbest )
+{
+  // Reduce the roads of each projection to the nbest roads with the
+  // lowest 2D fit chi2
+
+  for( vector<Rvec_t>::iterator it = roads.begin(); it != roads.end(); ++it ) {
+    Rvec_t& rvec = *it;
+    if( rvec.size() > nbest ) {
+      partial_sort( rvec.begin(), rvec.begin()+nbest, rvec.end(),
+		    Road::Chi2IsLess() );
+      rvec.resize( nbest );
+    }
+  }
+}
 
 //_____________________________________________________________________________
 UInt_t Tracker::MatchRoads( vector<Rvec_t>& roads,
-			    list< pair<Double_t,Rvec_t> >& combos_found,
+			    Combos_t& combos_found,
 			    Rset_t& unique_found )
 {
   // Match roads from different projections
   // The input vector 'roads' may be altered unpredictably.
   // Output in 'combos_found' and 'unique_found'
+  //
+  // If the number of possible road combinations exceeds the budget
+  // f3dMaxCombos, only the f3dNbestRoads roads with the lowest chi2
+  // of each projection are matched, reducing that number further if
+  // necessary. If f3dNbestRoads is zero, busy events are given up.
 
   combos_found.clear();
   unique_found.clear();
 
-  // Number of all possible combinations of the input roads
-  // May overflow for extremely busy events
-  UInt_t ncombos;
-  bool inrange = true;
-  try {
-    ncombos = accumulate( ALL(roads), (UInt_t)1, SizeMul<Rvec_t>() );
-  }
-  catch( overflow_error& ) {
-    ncombos = 0;
-    inrange = false;
+  // Number of all possible combinations of the input roads. Only used for
+  // the budget check; the matching algorithms never enumerate them all.
+  ULong64_t ncombos = CountCombos( roads );
+  bool inrange = ( ncombos <= f3dMaxCombos );
+  UInt_t nbest = 0;
+  if( !inrange and f3dNbestRoads > 0 ) {
+    nbest = f3dNbestRoads;
+    for( ; nbest > 0; --nbest ) {
+      KeepBestRoads( roads, nbest );
+      ncombos = CountCombos( roads );
+      if( ncombos <= f3dMaxCombos )
+	break;
+    }
+    inrange = ( nbest > 0 );
   }
 
 #ifdef VERBOSE
   if( fDebug > 0 ) {
     // The number of projections that we work with
     vector<Rvec_t>::size_type nproj = roads.size();
-    if( inrange )
+    if( inrange ) {
+      if( nbest > 0 )
+	cout << "Too many combinations, keeping the " << nbest
+	     << " best roads per projection. ";
       cout << "Matching ";
-    else
+    } else
       cout << "Too many combinations trying to match ";
     for( vector<Rvec_t>::size_type i = 0; i < nproj; ++i ) {
       cout << roads[i].size();
@@ -1641,18 +2331,23 @@ UInt_t Tracker::MatchRoads( vector<Rvec_t>& roads,
   }
 #endif
 #ifdef TESTCODE
-  fNcombos = ncombos;
+  fNcombos = static_cast<UInt_t>( TMath::Min(ncombos,(ULong64_t)kMaxUInt) );
 #endif
 
+  if( !inrange ) {
+    fTrkStat = kTooManyRoadCombos;
+    return 0;
+  }
   if( ncombos == 0 ) {
-    if( inrange )
-      fTrkStat = kNoRoadCombos;   // bug?
-    else
-      fTrkStat = kTooManyRoadCombos;
+    fTrkStat = kNoRoadCombos;   // bug?
     return 0;
   }
 
-  UInt_t nfound = MatchRoadsImpl( roads, ncombos, combos_found, unique_found );
+  // ncombos is only informational for the matching algorithms
+  UInt_t ncombos32 =
+    static_cast<UInt_t>( TMath::Min(ncombos,(ULong64_t)kMaxUInt) );
+  UInt_t nfound = MatchRoadsImpl( roads, ncombos32, combos_found,
+				  unique_found );
 
 #ifdef VERBOSE
   if( fDebug > 0 ) {
@@ -1685,6 +2380,41 @@ Bool_t Tracker::PassTrackCuts( const FitRes_t& fit_par ) const
   return true;
 }
 
+//_____________________________________________________________________________
+Int_t Tracker::TrackProjections()
+{
+  // Track() each projection. With a worker pool, the road searches and
+  // road fits of all projections are run as a task graph (see StagedTrack).
+  // In pipelined mode, this has already been started in Decode, and we
+  // only wait for it to finish. Returns 1 if any projection had an error.
+
+  vector<Int_t> nroads;
+  if( fStagedTrack ) {
+    if( !fStagedTrack->IsPending() )
+      fStagedTrack->Start();
+    fStagedTrack->Finish();
+    nroads = fStagedTrack->GetNroads();
+  } else {
+    nroads.resize( fProj.size() );
+    for( vpsiz_t k = 0; k < fProj.size(); ++k )
+      nroads[k] = fProj[k]->Track();
+  }
+  for( vpsiz_t k = 0; k < nroads.size(); ++k ) {
+    if( nroads[k] < 0 )
+      return 1;
+  }
+  return 0;
+}
+
+//_____________________________________________________________________________
+void Tracker::FinishAsyncTrack()
+{
+  // Wait for projection tracking started in Decode, if any
+
+  if( fStagedTrack )
+    fStagedTrack->Finish();
+}
+
 //_____________________________________________________________________________
 Int_t Tracker::CoarseTrack( TClonesArray& tracks )
 {
@@ -1705,17 +2435,7 @@ Int_t Tracker::CoarseTrack( TClonesArray& tracks )
   TStopwatch timer, timer_tot;
 #endif
 
-  Int_t err = 0;
-  if( fMaxThreads > 1 ) {
-    err = fThreads->Run( fMaxThreads );
-  } else {
-    // Single-threaded execution: Track() each projection in turn
-    for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it ) {
-      Int_t ret = (*it)->Track();
-      if( ret < 0 )
-	err = 1;
-    }
-  }
+  Int_t err = TrackProjections();
   // Abort on error (e.g. too many patterns)
   if( err != 0 ) {
     fTrkStat = kProjTrackError;
@@ -1758,8 +2478,8 @@ Int_t Tracker::CoarseTrack( TClonesArray& tracks )
 
   // Combine track projections to 3D tracks
   if( nproj >= fMinReqProj ) {
-    // Vector holding the results (vectors of roads with good matchval)
-    list< pair<Double_t,Rvec_t> > road_combos;
+    // Vector holding the results (combinations of roads with good matchval)
+    Combos_t road_combos;
     // Set of the unique roads occurring in the road_combos elements
     Rset_t unique_found;
 
@@ -1774,10 +2494,13 @@ Int_t Tracker::CoarseTrack( TClonesArray& tracks )
     // the 3D track parameters, x, x'(=mx), y, y'(=my)
     FitRes_t fit_par;
     fit_par.coef.reserve(4);
+    Rvec_t these_roads;
+    these_roads.reserve( kTypeEnd );
     if( nfits == 1 ) {
       // If there is only one combo (typical case), life is simple:
-      fit_par.matchval    = road_combos.front().first;
-      Rvec_t& these_roads = road_combos.front().second;
+      const Combo_t& combo = road_combos.front();
+      fit_par.matchval    = combo.matchval;
+      these_roads.assign( combo.roads, combo.roads+combo.n );
       fit_par.roads       = &these_roads;
       fit_par.ndof = FitTrack( these_roads, fit_par.coef, fit_par.chi2 );
       if( fit_par.ndof > 0 ) {
@@ -1791,38 +2514,59 @@ Int_t Tracker::CoarseTrack( TClonesArray& tracks )
     }
     else if( nfits > 1 ) {
       // For multiple road combinations, find the set of tracks with the
-      // lowest chi2s that uses each road at most once
-      typedef map<Rset_t, FitRes_t> FitResMap_t;
-      FitResMap_t fit_results;
-      multimap< TrackFitWeight, Rset_t > fit_chi2;
-      // Fit all combinations and sort the results by ascending chi2
-      for( list< pair<Double_t,Rvec_t> >::iterator it = road_combos.begin();
-	   it != road_combos.end(); ++it ) {
-	fit_par.matchval    = it->first;
-	Rvec_t& these_roads = it->second;
-	fit_par.roads       = &these_roads;
-	fit_par.ndof = FitTrack( these_roads, fit_par.coef, fit_par.chi2 );
-	if( fit_par.ndof > 0 ) {
-	  if( PassTrackCuts(fit_par) ) {
-	    Rset_t road_tuple( ALL(these_roads) );
-#ifndef NDEBUG
-	    pair<FitResMap_t::iterator,bool> ins =
-#endif
-	    fit_results.insert( make_pair(road_tuple, fit_par) );
-	    assert( ins.second );
-	    fit_chi2.insert( make_pair( TrackFitWeight(fit_par), road_tuple) );
+      // lowest chi2s that uses each road at most once.
+      // The road tuples of the good fits are kept in a flat array of
+      // indices into the (sorted) list of unique roads, with their fit
+      // results and weights in parallel arrays.
+      Rvec_t choices( ALL(unique_found) );
+      UInt_t width = 0;
+      for( Combos_t::iterator it = road_combos.begin();
+	   it != road_combos.end(); ++it )
+	width = TMath::Max( width, it->n );
+      vec_uint_t tuples;
+      tuples.reserve( nfits*width );
+      // Fit all combinations
+      vector<FitRes_t> all_fits;
+      FitTracks( road_combos, all_fits );
+      vector<FitRes_t> fit_results;
+      fit_results.reserve( nfits );
+      vector<TrackFitWeight> fit_chi2;
+      fit_chi2.reserve( nfits );
+      // Keep the good fits and sort them by ascending chi2
+      for( UInt_t ic = 0; ic < all_fits.size(); ++ic ) {
+	const Combo_t& combo = road_combos[ic];
+	FitRes_t& fit = all_fits[ic];
+	if( fit.ndof > 0 ) {
+	  if( PassTrackCuts(fit) ) {
+	    UInt_t itup = fit_results.size();
+	    fit_chi2.push_back( TrackFitWeight(fit, itup) );
+	    fit_results.push_back( fit );
+	    for( UInt_t j = 0; j < width; ++j ) {
+	      if( j < combo.n ) {
+		Rvec_t::iterator found =
+		  lower_bound( ALL(choices), combo.roads[j] );
+		assert( found != choices.end() and *found == combo.roads[j] );
+		tuples.push_back( found - choices.begin() );
+	      } else
+		tuples.push_back( kMaxUInt );
+	    }
 	  }
 	} else
-	  FitErrPrint( fit_par.ndof );
+	  FitErrPrint( fit.ndof );
       }
+      sort( ALL(fit_chi2) );
+      vec_uint_t fit_order;
+      fit_order.reserve( fit_chi2.size() );
+      for( vector<TrackFitWeight>::iterator it = fit_chi2.begin();
+	   it != fit_chi2.end(); ++it )
+	fit_order.push_back( it->GetTuple() );
 
 #ifdef VERBOSE
       if( fDebug > 2 ) {
 	cout << "Track candidates:" << endl;
-	for( multimap<TrackFitWeight,Rset_t>::iterator it = fit_chi2.begin();
-	     it != fit_chi2.end(); ++it ) {
-	  FitResMap_t::iterator found = fit_results.find((*it).second);
-	  FitRes_t& r = (*found).second;
+	for( vec_uint_t::iterator it = fit_order.begin();
+	     it != fit_order.end(); ++it ) {
+	  FitRes_t& r = fit_results[*it];
 	  cout	 << "ndof = " << r.ndof
 		 << " rchi2 = " << r.chi2/(double)r.ndof
 		 << " x/y = " << r.coef[0] << "/" << r.coef[2]
@@ -1831,22 +2575,48 @@ Int_t Tracker::CoarseTrack( TClonesArray& tracks )
 	}
       }
 #endif
-      if( !fit_chi2.empty() ) {
+      if( !fit_order.empty() ) {
 	// Select "optimal" set of roads, minimizing sum of chi2s
-	vector<Rset_t> best_roads;
-	OptimalN( unique_found, fit_chi2, best_roads,
-		  AnySharedHits(), CheckTypes(found_types) );
+	vec_uint_t best_tuples;
+	TupleBits tuple_bits( choices, tuples, width );
+	OptimalN( tuple_bits, fit_order, found_types, best_tuples );
+	// For few candidates, search for the best set exactly
+	if( fit_order.size() <= f3dExactMaxTuples ) {
+	  vector<Double_t> chi2( fit_results.size() );
+	  for( UInt_t itup = 0; itup < fit_results.size(); ++itup )
+	    chi2[itup] = fit_results[itup].chi2;
+	  ExactOptimalN exact( tuple_bits, fit_order, chi2, found_types,
+			       f3dExactMaxNodes );
+	  if( !exact.Solve(best_tuples) ) {
+	    fExactLimit = 1;
+	    ++fNexactLimit;
+	  }
+	  fNexactNodes = exact.GetNnodes();
+#ifdef VERBOSE
+	  if( fDebug > 2 )
+	    cout << "Exact track selection: " << fNexactNodes << " nodes"
+		 << (fExactLimit ? " (limit reached)" : "") << endl;
+#endif
+	}
 
-	if( best_roads.empty() )
+	if( best_tuples.empty() )
 	  fTrkStat = kFailedOptimalN;
 
 	// Now each selected road tuple corresponds to a new track
-	for( vector<Rset_t>::iterator it = best_roads.begin(); it !=
-	       best_roads.end(); ++it ) {
-	  // Retrieve the fit results for this tuple
-	  FitResMap_t::iterator found = fit_results.find(*it);
-	  assert( found != fit_results.end() );
-	  NewTrack( tracks, (*found).second );
+	for( vec_uint_t::iterator it = best_tuples.begin(); it !=
+	       best_tuples.end(); ++it ) {
+	  // Retrieve the roads and fit results for this tuple
+	  UInt_t itup = *it;
+	  assert( itup < fit_results.size() );
+	  these_roads.clear();
+	  for( UInt_t j = 0; j < width; ++j ) {
+	    UInt_t k = tuples[itup*width+j];
+	    if( k != kMaxUInt )
+	      these_roads.push_back( choices[k] );
+	  }
+	  FitRes_t& res = fit_results[itup];
+	  res.roads = &these_roads;
+	  NewTrack( tracks, res );
 	}
       }
       else {
@@ -1954,6 +2724,8 @@ Int_t Tracker::DefineVariables( EMode mode )
   // Define tracking-related variables only if doing tracking
   if( TestBit(kDoCoarse) ) {
     RVarDef vars_tracking[] = {
+      { "exactnodes", "Nodes searched in exact de-ghosting", "fNexactNodes" },
+      { "exactlimit", "Exact de-ghosting hit node limit",   "fExactLimit" },
 #ifdef TESTCODE
       { "ncombos",    "Number of road combinations",        "fNcombos" },
       { "nfits",      "Number of 3D track fits done",       "fN3dFits" },
@@ -1981,6 +2753,51 @@ Projection* Tracker::MakeProjection( EProjType type, const char* name,
   return new Projection( type, name, angle, parent );
 }
 
+//_____________________________________________________________________________
+void Tracker::InitProjPairs()
+{
+  // Precompute the geometry needed for intersecting roads of any two
+  // projections and for checking the intersection points against the
+  // active areas of the front and back planes. Called from Init once the
+  // projection angles and plane positions are known, so that the matching
+  // algorithms do not need to recompute these for every road combination.
+
+  fProjPairs.assign( kTypeEnd*kTypeEnd, ProjPair_t() );
+  for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it ) {
+    const Projection* pu = *it;
+    Double_t su = pu->GetSinAngle(), cu = pu->GetCosAngle();
+    for( vpiter_t jt = fProj.begin(); jt != fProj.end(); ++jt ) {
+      const Projection* pv = *jt;
+      if( pv == pu )
+	continue;
+      Double_t sv = pv->GetSinAngle(), cv = pv->GetCosAngle();
+      // Standard formulae for the intersection of non-orthogonal coordinates
+      // (cf. Road::Intersect). The angle checks in Init ensure that the
+      // denominator is not near zero.
+      Double_t inv_denom = 1.0/(sv*cu-su*cv);
+      ProjPair_t& pp = fProjPairs[pu->GetType()*kTypeEnd+pv->GetType()];
+      pp.cxu =  sv*inv_denom;
+      pp.cxv = -su*inv_denom;
+      pp.cyu = -cv*inv_denom;
+      pp.cyv =  cu*inv_denom;
+    }
+  }
+
+  // Front intersections are taken at the tracker origin, back ones in the
+  // last plane. The fiducial checks use the first and last planes.
+  const Plane *front_plane = fPlanes.front(), *back_plane = fPlanes.back();
+  fFrontZ = 0.0;
+  fBackZ  = back_plane->GetZ();
+  fFrontBox.x0 = front_plane->GetOrigin().X();
+  fFrontBox.y0 = front_plane->GetOrigin().Y();
+  fFrontBox.dx = front_plane->GetSize()[0];
+  fFrontBox.dy = front_plane->GetSize()[1];
+  fBackBox.x0  = back_plane->GetOrigin().X();
+  fBackBox.y0  = back_plane->GetOrigin().Y();
+  fBackBox.dx  = back_plane->GetSize()[0];
+  fBackBox.dy  = back_plane->GetSize()[1];
+}
+
 //_____________________________________________________________________________
 THaAnalysisObject::EStatus Tracker::Init( const TDatime& date )
 {
@@ -2156,8 +2973,10 @@ THaAnalysisObject::EStatus Tracker::Init( const TDatime& date )
     }
   }
 
-  // Check if we can use the simplified 3D matching algorithm
-  //TODO: generalize to 4 projections with symmetry?
+  // Precompute projection-pair coefficients for 3D matching
+  InitProjPairs();
+
+  // Check if we can use one of the simplified 3D matching algorithms
   vector<ProjAngle_t>::size_type nproj = fProj.size();
   if( nproj == 3 ) {
     // Algorithm:
@@ -2225,13 +3044,58 @@ THaAnalysisObject::EStatus Tracker::Init( const TDatime& date )
       if( fDebug > 0 )
 	Info( Here(here), "Enabled fast 3D projection matching" );
     }
-  }
-
-  // If threading requested, load thread library and start up threads
+  } else if( nproj >= 4 ) {
+    // Seed the matching with the best-conditioned pair of projections,
+    // i.e. the one whose axes are closest to perpendicular
+    Double_t smax = 0;
+    f3dSeed.assign( 2, kMaxUInt );
+    for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it ) {
+      for( vpiter_t jt = it+1; jt != fProj.end(); ++jt ) {
+	Double_t sinang = TMath::Abs( (*it)->GetAxis()^(*jt)->GetAxis() );
+	if( sinang > smax ) {
+	  smax = sinang;
+	  f3dSeed[0] = (*it)->GetType();
+	  f3dSeed[1] = (*jt)->GetType();
+	}
+      }
+    }
+    assert( f3dSeed[0] != kMaxUInt ); // else angle checks above failed
+    if( fDebug > 0 )
+      Info( Here(here), "Enabled fast %u-projection matching, seeded by "
+	    "%s/%s", (UInt_t)nproj, kProjParam[f3dSeed[0]].name,
+	    kProjParam[f3dSeed[1]].name );
+  }
+
+  // If threading requested, load thread library and start up the worker
+  // pool. All parallel work (decoding, tracking and road fitting of the
+  // projections, 3D matching and fitting) is run on this one pool. The
+  // thread submitting work helps process it, so the pool has one thread
+  // less than the maximum number of threads.
+  // Any pool from a previous initialization is shut down first, so that
+  // re-initializing with maxthreads = 1 does not leave it in use.
+  delete fStagedTrack; fStagedTrack = 0;
+  for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it )
+    (*it)->SetFitPool( 0 );
+  delete fPool; fPool = 0;
   if( fMaxThreads > 1 ) {
-    delete fThreads; fThreads = 0;
     if( gSystem->Load("libThread") >= 0 ) {
-      fThreads = new ThreadCtrl( fProj );
+      fPool = new TaskPool( fMaxThreads-1, fPoolSpin, &fPoolCPUs );
+      for( vpiter_t it = fProj.begin(); it != fProj.end(); ++it )
+	(*it)->SetFitPool( fPool );
+      fStagedTrack = new StagedTrack( fProj, fPool );
+      // Report the placement of the worker threads
+      if( !fPoolCPUs.empty() ) {
+	TString placement;
+	for( UInt_t i = 0; i < fPool->GetNthreads(); ++i ) {
+	  Int_t cpu = fPool->GetThreadCPU(i);
+	  Int_t node = GetNumaNode(cpu);
+	  placement += Form( " %d", cpu );
+	  if( node >= 0 )
+	    placement += Form( "(%d)", node );
+	}
+	Info( Here(here), "Worker threads pinned to CPUs (NUMA node):%s",
+	      placement.Data() );
+      }
     } else {
       // Error loading library
       Warning( Here(here), "Error loading thread library. Falling back to "
@@ -2295,9 +3159,14 @@ Int_t Tracker::ReadDatabase( const TDatime& date )
   Int_t mc_data = 0;
 #endif
   Int_t maxthreads = -1;
+  Double_t maxcombos = kMaxUInt;
+  Int_t nbestroads = 10, mt_3dminpairs = 10000, mt_pipeline = 0, mt_spin = -1;
+  string mt_cpus;
+  Int_t exactmaxtuples = 0, exactmaxnodes = 100000;
   fDBmaxmiss = -1;
   fDBconf_level = 1e-9;
   ResetBit( k3dFastMatch ); // Set in Init()
+  f3dSeed.clear();          // Ditto
   assert( GetCrateMapDBcols() >= 5 );
   DBRequest request[] = {
     { "planeconfig",       &planeconfig,       kString },
@@ -2314,7 +3183,15 @@ Int_t Tracker::ReadDatabase( const TDatime& date )
     { "3d_maxmiss",        &fDBmaxmiss,        kInt,    0, 1 },
     { "3d_chi2_conflevel", &fDBconf_level,     kDouble, 0, 1 },
     { "3d_disable_chi2",   &disable_chi2,      kInt,    0, 1 },
+    { "3d_maxcombos",      &maxcombos,         kDouble, 0, 1 },
+    { "3d_nbestroads",     &nbestroads,        kInt,    0, 1 },
+    { "3d_exactmaxtuples", &exactmaxtuples,    kInt,    0, 1 },
+    { "3d_exactmaxnodes",  &exactmaxnodes,     kInt,    0, 1 },
     { "maxthreads",        &maxthreads,        kInt,    0, 1 },
+    { "mt_3dminpairs",     &mt_3dminpairs,     kInt,    0, 1 },
+    { "mt_pipeline",       &mt_pipeline,       kInt,    0, 1 },
+    { "mt_spin",           &mt_spin,           kInt,    0, 1 },
+    { "mt_cpus",           &mt_cpus,           kString, 0, 1 },
     { 0 }
   };
 
@@ -2362,6 +3239,37 @@ Int_t Tracker::ReadDatabase( const TDatime& date )
   SetBit( kDoChi2,        !disable_chi2 );
   SetBit( kProjTrackToZ0, proj_to_z0 );
 
+  // Budget for 3D road matching. Events exceeding it are matched using only
+  // the 3d_nbestroads best roads of each projection (0 = give up instead)
+  f3dMaxCombos = ( maxcombos >= 1.0 ) ? static_cast<ULong64_t>(maxcombos) : 1;
+  f3dNbestRoads = ( nbestroads > 0 ) ? nbestroads : 0;
+  // Exact selection of the best set of 3D tracks for up to 3d_exactmaxtuples
+  // candidates (0 = always greedy), limited to 3d_exactmaxnodes search steps
+  f3dExactMaxTuples = ( exactmaxtuples > 0 ) ?
+    TMath::Min( static_cast<UInt_t>(exactmaxtuples), ExactOptimalN::kMaxTuples )
+    : 0;
+  f3dExactMaxNodes = ( exactmaxnodes > 0 ) ? exactmaxnodes : 1;
+  // With maxthreads > 1, minimum number of seed road pairs for which 3D
+  // matching is run in parallel (<= 0 disables)
+  f3dMinParallelPairs = ( mt_3dminpairs > 0 ) ? mt_3dminpairs : kMaxUInt;
+  // With maxthreads > 1, start tracking the projections already in Decode,
+  // to overlap it with the decoding of the other detectors
+  fPipeline = ( mt_pipeline != 0 );
+  // Number of iterations that idle pool threads poll for work before going
+  // to sleep. Trades CPU time for lower dispatch latency. < 0: automatic,
+  // set below once the number of threads is known
+  fPoolSpin = ( mt_spin >= 0 ) ? mt_spin : kMaxUInt;
+  // CPUs to pin the worker threads to, e.g. "0-7,16-23" for the cores of
+  // one socket. The environment variable TREESEARCH_CPUS takes precedence.
+  const char* env_cpus = gSystem->Getenv("TREESEARCH_CPUS");
+  if( env_cpus )
+    mt_cpus = env_cpus;
+  if( ParseCPUList(mt_cpus, fPoolCPUs) != 0 ) {
+    Error( Here(here), "Illegal CPU list \"%s\". Fix database or "
+	   "TREESEARCH_CPUS.", mt_cpus.c_str() );
+    return kInitError;
+  }
+
   cout << endl;
   if( fDebug > 0 ) {
 #ifdef MCDATA
@@ -2438,15 +3346,13 @@ Int_t Tracker::ReadDatabase( const TDatime& date )
   // has priority. maxthreads = 0 or negative indicates that the number of
   // CPUs/cores of the current host should be used. If not available, use 1.
   // To ensure single-threaded processing, set maxthreads = 1 in the database.
-  // The number of threads is capped by the maximum that the ThreadCtrl class
-  // supports - currently 31 due to the size of UInt_t, which is more than
-  // enough since we never run more threads than the number of projections.
+  // The number of threads is independent of the number of projections.
   bool warn = false;
+  SysInfo_t sysifo;
+  gSystem->GetSysInfo( &sysifo );
   if( maxthreads > 0 )
     fMaxThreads = maxthreads;
   else {
-    SysInfo_t sysifo;
-    gSystem->GetSysInfo( &sysifo );
     if( sysifo.fCpus > 0 )
       fMaxThreads = sysifo.fCpus;
     else {
@@ -2454,8 +3360,16 @@ Int_t Tracker::ReadDatabase( const TDatime& date )
       fMaxThreads = 1;
     }
   }
-  // Limit number of threads to what ThreadCtrl can support (currently = 31)
-  fMaxThreads = min(fMaxThreads, ThreadCtrl::GetMaxThreads());
+  // Automatic spin: idle pool threads bridge the short gaps between the
+  // parallel stages of an event by spinning, but only if every thread can
+  // have a CPU of its own. With more threads than CPUs, spinning takes
+  // CPU time away from the threads doing the work and delays the event.
+  if( fPoolSpin == kMaxUInt ) {
+    bool own_cpus = ( sysifo.fCpus > 0 and
+		      static_cast<UInt_t>(sysifo.fCpus) >= fMaxThreads and
+		      ( fPoolCPUs.empty() or fPoolCPUs.size()+1 >= fMaxThreads ));
+    fPoolSpin = own_cpus ? kPoolAutoSpin : 0;
+  }
   if( warn )
     Warning( Here(here), "Cannot determine number of CPU cores. "
 	     "Falling back to single-threaded processing." );
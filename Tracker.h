@@ -20,6 +20,7 @@
 #include <exception>
 #include "TMatrixDSym.h"
 #include "TRotation.h"
+#include "TMath.h"
 #ifndef MCDATA
 #include "THaEvData.h"
 #else
@@ -40,7 +41,7 @@ namespace TreeSearch {
   class Projection;
   class Road;
   class Hit;
-  class ThreadCtrl;  // Defined in implementation
+  class TaskPool;
 
   typedef std::vector<Road*> Rvec_t;
   typedef std::set<Road*>    Rset_t;
@@ -103,7 +104,7 @@ namespace TreeSearch {
       kFailedTrackCuts     = 6, // All road combos failed ndof & chi2 cuts
       kFailedOptimalN      = 7, // Failed 3D de-ghosting algorithm
       // MatchRoads
-      kTooManyRoadCombos   = 8, // Overflow in MatchRoads
+      kTooManyRoadCombos   = 8, // Road combination budget exceeded
       kNoRoadCombos        = 9  // Product of road vector sizes = 0 (bug?)
     };
     ETrackingStatus GetTrackingStatus() const { return fTrkStat; }
@@ -120,6 +121,11 @@ namespace TreeSearch {
   protected:
     friend class Plane;
     class TrackFitWeight;
+    class MatchRowTask;
+    friend class MatchRowTask;
+    class TrackFitTask;
+    friend class TrackFitTask;
+    class StagedTrack;
     struct FitRes_t {
       vector<Double_t> coef;
       Double_t matchval;
@@ -128,6 +134,22 @@ namespace TreeSearch {
       Rvec_t*  roads;
       FitRes_t() : matchval(0), chi2(0), ndof(0), roads(0) {}
     };
+    // Combination of roads matched in 3D, one from each projection, in the
+    // order of the input to MatchRoads. Fixed-size, so that combinations
+    // can be stored contiguously.
+    struct Combo_t {
+      Double_t matchval;         // 3D match value
+      UInt_t   n;                // Number of roads
+      Road*    roads[kTypeEnd];  // The roads
+      Combo_t() : matchval(0), n(0) {}
+      Combo_t( Double_t mval, Road* const* first, UInt_t nroads )
+	: matchval(mval), n(nroads)
+      {
+	assert( nroads <= (UInt_t)kTypeEnd );
+	for( UInt_t i = 0; i < nroads; ++i ) roads[i] = first[i];
+      }
+    };
+    typedef std::vector<Combo_t> Combos_t;
 
     typedef std::vector<Plane*>  Rpvec_t;
     typedef std::vector<Projection*> Prvec_t;
@@ -147,13 +169,53 @@ namespace TreeSearch {
 
     // Multithread support
     UInt_t         fMaxThreads;       // Maximum simultaneously active threads
-    ThreadCtrl*    fThreads;          //! Thread controller
+    TaskPool*      fPool;             //! Worker pool for all tracking tasks
+    Bool_t         fPipeline;         // Start projection tracking in Decode
+    UInt_t         fPoolSpin;         // Spin iterations of idle pool threads
+    vector<Int_t>  fPoolCPUs;         // CPUs to pin pool threads to (or none)
+    StagedTrack*   fStagedTrack;      //! Projection tracking task graph
 
     // Parameters for 3D projection matching
     UInt_t         fMinReqProj;  // Minimum # proj required for 3D match
     Double_t       f3dMatchvalScalefact; // Correction for fast 3D matchval
     Double_t       f3dMatchCut;  // Maximum allowed 3D match error
+    ULong64_t      f3dMaxCombos; // Max # road combinations to match (budget)
+    UInt_t         f3dNbestRoads;// # best roads/proj to match if over budget
+    UInt_t         f3dMinParallelPairs; // Min # seed pairs for parallel match
+    UInt_t         f3dExactMaxTuples; // Max # track candidates for exact
+                                      // de-ghosting (0 = greedy only)
+    UInt_t         f3dExactMaxNodes;  // Node limit for exact de-ghosting
     vec_uint_t     f3dIdx;       // Lookup table proj index -> fast 3d index
+    vec_uint_t     f3dSeed;      // Seed proj types for fast N-proj matching
+
+    // Projection-pair geometry for 3D matching, precomputed in Init.
+    // The intersection of the positions pu and pv of roads in projections
+    // of type u and v is (x,y) = (pu*cxu + pv*cxv, pu*cyu + pv*cyv).
+    struct ProjPair_t {
+      Double_t cxu, cxv, cyu, cyv;
+      ProjPair_t() : cxu(0), cxv(0), cyu(0), cyv(0) {}
+      Double_t X( Double_t pu, Double_t pv ) const { return pu*cxu + pv*cxv; }
+      Double_t Y( Double_t pu, Double_t pv ) const { return pu*cyu + pv*cyv; }
+    };
+    // Rectangular active area of a plane, same test as Plane::Contains
+    struct PlaneBox_t {
+      Double_t x0, y0, dx, dy;
+      PlaneBox_t() : x0(0), y0(0), dx(0), dy(0) {}
+      Bool_t Contains( Double_t x, Double_t y ) const
+      { return ( TMath::Abs(x-x0) < dx and TMath::Abs(y-y0) < dy ); }
+    };
+    vector<ProjPair_t> fProjPairs; // [kTypeEnd*kTypeEnd] Pair coefficients
+    Double_t       fFrontZ;      // z of front matching plane (tracker origin)
+    Double_t       fBackZ;       // z of back matching plane (last plane)
+    PlaneBox_t     fFrontBox;    // Active area of front plane
+    PlaneBox_t     fBackBox;     // Active area of back plane
+
+    const ProjPair_t& GetProjPair( EProjType u, EProjType v ) const
+    {
+      assert( u != v and u*kTypeEnd+v < (Int_t)fProjPairs.size() );
+      return fProjPairs[u*kTypeEnd+v];
+    }
+    void      InitProjPairs();
 
     // Track fit cut parameters
     Int_t          fMinNdof;     // Minimum number of points in fit-4
@@ -161,6 +223,12 @@ namespace TreeSearch {
 
     // Event-by-event data
     ETrackingStatus fTrkStat;    // Reconstruction status
+    UInt_t         fNexactNodes; // # nodes searched by exact de-ghosting
+    Int_t          fExactLimit;  // Exact de-ghosting reached node limit
+
+    // Statistics
+    UInt_t         fNexactLimit; // # events where exact de-ghosting
+                                 // reached the node limit
 
     // Only needed for TESTCODE, but kept for binary compatibility
     UInt_t         fNcombos;     // # of road combinations tried
@@ -169,25 +237,64 @@ namespace TreeSearch {
     Double_t       t_track, t_3dmatch, t_3dfit, t_coarse; // times in us
 
     void      Add3dMatch( const Rvec_t& selected, Double_t matchval,
-			  std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+			  Combos_t& combos_found,
+			  Rset_t& unique_found ) const;
+    void      Add3dMatch( const Combo_t& combo, Combos_t& combos_found,
 			  Rset_t& unique_found ) const;
     void      FitErrPrint( Int_t err ) const;
     Int_t     FitTrack( const Rvec_t& roads, vector<Double_t>& coef,
 			Double_t& chi2, TMatrixDSym* coef_covar = 0 ) const;
+    void      FitTracks( const Combos_t& combos,
+			 vector<FitRes_t>& fits ) const;
+    void      FitTrackRange( const Combos_t& combos, UInt_t first,
+			     UInt_t last, vector<FitRes_t>& fits ) const;
     template< typename Action > static
     Action    ForAllTrackPoints( const Rvec_t& roads,
 				 const vector<Double_t>& coef, Action action );
     THaTrack* NewTrack( TClonesArray& tracks, const FitRes_t& fit_par );
+    Int_t     TrackProjections();
+    void      FinishAsyncTrack();
     Bool_t    PassTrackCuts( const FitRes_t& fit_par ) const;
 
+    // Setup of MatchRoadsSeeded, shared by all its rows
+    struct SeedSetup_t {
+      vector<Rvec_t*>   proj_roads; // Roads in processing order
+      vector<UInt_t>    outidx;     // Output index of each proj_roads element
+      vector<EProjType> type;       // Projection types
+      vector<Double_t>  axx, axy;   // Projection axes
+      vector<Double_t>  window;     // Search half-width around seed point
+    };
+
+    Double_t  MatchValue( const Rvec_t& selected ) const;
+    Bool_t    UseMatchPool( UInt_t nrows, UInt_t ncols ) const;
+    UInt_t    MatchRows( vector<Combos_t>& rows, const vector<Rvec_t>* roads,
+		   const SeedSetup_t* setup,
+		   Combos_t& combos_found,
+		   Rset_t& unique_found );
+    UInt_t    Save3dMatches( const Combos_t& matches,
+		   Combos_t& combos_found,
+		   Rset_t& unique_found ) const;
+    void      MatchSeededRow( const SeedSetup_t& setup, UInt_t irow,
+			      Combos_t& matches ) const;
+    void      MatchFast3DRow( const vector<Rvec_t>& roads, UInt_t ird0,
+			      Combos_t& matches ) const;
     UInt_t    MatchRoadsGeneric( vector<Rvec_t>& roads, UInt_t ncombos,
-		   std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+		   Combos_t& combos_found,
 		   Rset_t& unique_found );
 
     UInt_t    MatchRoadsFast3D( vector<Rvec_t>& roads, UInt_t ncombos,
-	           std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+	           Combos_t& combos_found,
+	           Rset_t& unique_found );
+
+    UInt_t    MatchRoadsFastN( vector<Rvec_t>& roads, UInt_t ncombos,
+	           Combos_t& combos_found,
 	           Rset_t& unique_found );
 
+    UInt_t    MatchRoadsSeeded( vector<Rvec_t>& roads,
+		   const vector<Rvec_t*>& proj_roads,
+		   Combos_t& combos_found,
+		   Rset_t& unique_found );
+
     // Virtualization of the tracker class, specialized Trackers may/must
     // override
     virtual Plane* MakePlane( const char* name, const char* description = "",
@@ -198,10 +305,10 @@ namespace TreeSearch {
     virtual UInt_t GetCrateMapDBcols() const = 0;
 
     virtual UInt_t MatchRoads( vector<Rvec_t>& roads,
-	         std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+	         Combos_t& combos_found,
 		 Rset_t& unique_found );
     virtual UInt_t MatchRoadsImpl( vector<Rvec_t>& roads, UInt_t ncombos,
-                 std::list<std::pair<Double_t,Rvec_t> >& combos_found,
+                 Combos_t& combos_found,
                  Rset_t& unique_found ) = 0;
 
     virtual THaAnalysisObject::EStatus PartnerPlanes() = 0;